@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include "orderbook.hpp"
+
+// Per-symbol book configuration. Ladder and pool are sized from it, so thin symbols do not pay for deep ones
+struct SymbolConfig {
+    uint32_t symbol; // External symbol ID, the manager keeps a direct lookup table up to the largest one
+    size_t price_min;
+    size_t price_max;
+    size_t tick_size;
+    size_t max_orders;
+    size_t chunk_orders = 1'024; // Pool growth step, the first chunk is mapped up front
+    bool hot = false; // Placed at the front of the arena next to the other hot symbols
+};
+
+// Owns one book per symbol in a single arena, indexed by dense IDs 0..size()-1. Hot symbols get the lowest dense IDs
+// and are constructed first, so their book headers share cache lines and pages and their ladders tend to be
+// allocated next to each other. Books never move once built. Throws std::invalid_argument if a symbol is listed twice
+template <typename Layout = PointerLayout>
+struct BookManager {
+    using Book = OrderBook<RuntimeInstrument, Layout>;
+    static constexpr uint32_t NO_BOOK = std::numeric_limits<uint32_t>::max();
+
+    Book* books_ = nullptr;
+    size_t size_ = 0;
+    std::vector<uint32_t> dense_of_; // External symbol ID -> dense ID, NO_BOOK if the symbol is unknown
+    std::vector<uint32_t> symbol_of_; // Dense ID -> external symbol ID
+
+    explicit BookManager(const std::vector<SymbolConfig>& configs, LevelSearch level_search = LevelSearch::Bitmap) {
+        std::vector<const SymbolConfig*> order;
+        order.reserve(configs.size());
+        uint32_t max_symbol = 0;
+        for (const SymbolConfig& config : configs) {
+            if (config.hot) order.push_back(&config);
+            max_symbol = std::max(max_symbol, config.symbol);
+        }
+        for (const SymbolConfig& config : configs) {
+            if (!config.hot) order.push_back(&config);
+        }
+
+        dense_of_.assign(configs.empty() ? 0 : size_t{max_symbol} + 1, NO_BOOK);
+        symbol_of_.reserve(configs.size());
+        books_ = static_cast<Book*>(::operator new(sizeof(Book) * configs.size(), std::align_val_t{alignof(Book)}));
+        try {
+            for (const SymbolConfig* config : order) {
+                if (dense_of_[config->symbol] != NO_BOOK) throw std::invalid_argument("Duplicate symbol");
+                new (&books_[size_]) Book(
+                    RuntimeInstrument(config->price_min, config->price_max, config->tick_size, config->max_orders),
+                    PoolOptions{config->chunk_orders, false},
+                    level_search
+                );
+                dense_of_[config->symbol] = static_cast<uint32_t>(size_);
+                symbol_of_.push_back(config->symbol);
+                ++size_;
+            }
+        } catch (...) {
+            // The destructor does not run for a constructor that throws, so the books built so far go here
+            destroy();
+            throw;
+        }
+    }
+
+    ~BookManager() { destroy(); }
+
+    void destroy() noexcept {
+        for (size_t i = size_; i-- > 0; ) books_[i].~Book();
+        ::operator delete(books_, std::align_val_t{alignof(Book)});
+        books_ = nullptr;
+        size_ = 0;
+    }
+
+    BookManager(const BookManager&) = delete;
+    BookManager& operator=(const BookManager&) = delete;
+
+    size_t size() const noexcept { return size_; }
+
+    uint32_t dense_id(uint32_t symbol) const noexcept {
+        return symbol < dense_of_.size() ? dense_of_[symbol] : NO_BOOK;
+    }
+
+    Book& book(uint32_t dense_id) noexcept { return books_[dense_id]; }
+    const Book& book(uint32_t dense_id) const noexcept { return books_[dense_id]; }
+
+    // Routes a command to the book of command.symbol. An unknown symbol is rejected and returns false, otherwise
+    // this returns what the book returned
+    template <typename Sink>
+    bool execute(const OrderCmd& command, Sink&& sink) {
+        uint32_t dense = dense_id(command.symbol);
+        if (dense == NO_BOOK) {
+            deliver(sink, ExecutionReport{
+                command.id, ExecutionReport::NO_ORDER, command.price, command.quantity, 0, ExecType::Reject,
+                RejectReason::UnknownSymbol, command.is_bid
+            });
+            return false;
+        }
+        return books_[dense].execute(command, sink);
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <nmmintrin.h>
+
+// CRC-32C (Castagnoli), the polynomial SSE4.2 has an instruction for. crc32c() picks the hardware version with CPUID
+// once, the bitwise fallback is slow but only there for old machines
+
+inline uint32_t crc32c_scalar(uint32_t crc, const void* data, size_t size) noexcept {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_sse42(uint32_t crc, const void* data, size_t size) noexcept {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t value = ~crc & 0xFFFFFFFFu;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        value = _mm_crc32_u64(value, word);
+    }
+    uint32_t tail = static_cast<uint32_t>(value);
+    for (; i < size; ++i) tail = _mm_crc32_u8(tail, bytes[i]);
+    return ~tail;
+}
+
+using Crc32cFn = uint32_t (*)(uint32_t, const void*, size_t) noexcept;
+
+inline Crc32cFn select_crc32c() noexcept {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") ? crc32c_sse42 : crc32c_scalar;
+}
+
+// Continues from crc, start with 0
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t size) noexcept {
+    static const Crc32cFn fn = select_crc32c();
+    return fn(crc, data, size);
+}
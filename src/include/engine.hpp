@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include "orderbook.hpp"
+
+// Busy-wait step. Yields now and then so spinning threads still make progress when they share a core
+inline void spin_wait(size_t& spins) noexcept {
+    __builtin_ia32_pause();
+    if ((++spins & 1'023) == 0) std::this_thread::yield();
+}
+
+// Pins a running thread to one CPU, does nothing for a negative cpu
+inline void pin_thread(std::thread& thread, int cpu) noexcept {
+    if (cpu < 0) return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+}
+
+// Single producer, single consumer ring. Each side keeps a cached copy of the other side's index and only reloads
+// it when the ring looks full or empty, so the shared lines move only when they have to
+template <typename T, size_t N>
+struct SpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+    alignas(64) std::atomic<size_t> head_{0}; // Next slot to write
+    size_t cached_tail_ = 0; // Producer's view of tail_
+    alignas(64) std::atomic<size_t> tail_{0}; // Next slot to read
+    size_t cached_head_ = 0; // Consumer's view of head_
+    alignas(64) T slots_[N];
+
+    bool try_push(const T& value) noexcept {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ == N) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ == N) return false;
+        }
+        slots_[head & (N - 1)] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& out) noexcept {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == cached_head_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail == cached_head_) return false;
+        }
+        out = slots_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Multiple producer, single consumer ring. Producers claim a slot by bumping head_, every slot carries a sequence
+// number that tells whether it is free to write (== position) or ready to read (== position + 1)
+template <typename T, size_t N>
+struct MpscRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+    struct Slot {
+        std::atomic<size_t> sequence_;
+        T value_;
+    };
+
+    alignas(64) std::atomic<size_t> head_{0}; // Next position to claim
+    alignas(64) size_t tail_ = 0; // Next position to read, consumer only
+    alignas(64) Slot slots_[N];
+
+    MpscRing() noexcept {
+        for (size_t i = 0; i < N; ++i) slots_[i].sequence_.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(const T& value) noexcept {
+        size_t position = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[position & (N - 1)];
+            size_t sequence = slot->sequence_.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(sequence - position);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false; // Full, the consumer has not freed this slot yet
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value_ = value;
+        slot->sequence_.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& out) noexcept {
+        Slot& slot = slots_[tail_ & (N - 1)];
+        if (slot.sequence_.load(std::memory_order_acquire) != tail_ + 1) return false;
+        out = slot.value_;
+        slot.sequence_.store(tail_ + N, std::memory_order_release);
+        ++tail_;
+        return true;
+    }
+};
+
+// Single-writer engine: gateway threads push OrderCmds into the inbound ring (SpscRing for one gateway, MpscRing
+// for several), one thread owns the book and drains commands in batches, and every execution report goes out on
+// an SPSC ring to one publisher thread. The book must not be touched by other threads while the engine runs, apart
+// from reading top_of_book_. The engine waits for room when the outbound ring is full.
+// Book is anything with execute(const OrderCmd&, Sink&&), an OrderBook or a BookManager
+template <typename Book, typename InboundRing, size_t OUTBOUND_SIZE = size_t{1} << 16>
+struct MatchingEngine {
+    static constexpr size_t BATCH = 256; // Commands handled between checks of the stop flag
+
+    struct OutboundSink {
+        SpscRing<ExecutionReport, OUTBOUND_SIZE>& ring_;
+        size_t& stalls_;
+
+        void operator()(const ExecutionReport& report) noexcept {
+            size_t spins = 0;
+            while (!ring_.try_push(report)) {
+                ++stalls_;
+                spin_wait(spins);
+            }
+        }
+    };
+
+    Book& book_;
+    InboundRing inbound_;
+    SpscRing<ExecutionReport, OUTBOUND_SIZE> outbound_;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+    std::atomic<size_t> processed_{0}; // Commands fully handled, stored after each batch
+    size_t stalls_ = 0; // Spins on a full outbound ring, engine thread only
+
+    explicit MatchingEngine(Book& book) : book_(book) {}
+    ~MatchingEngine() { stop(); }
+
+    MatchingEngine(const MatchingEngine&) = delete;
+    MatchingEngine& operator=(const MatchingEngine&) = delete;
+
+    // Pins the engine thread to cpu unless it is negative
+    void start(int cpu = -1) {
+        running_.store(true, std::memory_order_relaxed);
+        thread_ = std::thread([this] { run(); });
+        pin_thread(thread_, cpu);
+    }
+
+    // Commands already in the inbound ring are still processed
+    void stop() {
+        running_.store(false, std::memory_order_release);
+        if (thread_.joinable()) thread_.join();
+    }
+
+    // Gateway side, false if the inbound ring is full
+    bool submit(const OrderCmd& command) noexcept { return inbound_.try_push(command); }
+
+    // Publisher side, false if there is no report waiting
+    bool poll(ExecutionReport& report) noexcept { return outbound_.try_pop(report); }
+
+    void run() noexcept {
+        OutboundSink sink{outbound_, stalls_};
+        OrderCmd command;
+        size_t spins = 0;
+        for (;;) {
+            bool stopping = !running_.load(std::memory_order_acquire);
+            size_t handled = 0;
+            while (handled < BATCH && inbound_.try_pop(command)) {
+                book_.execute(command, sink);
+                ++handled;
+            }
+            processed_.store(processed_.load(std::memory_order_relaxed) + handled, std::memory_order_release);
+            if (handled == 0) {
+                if (stopping) return;
+                spin_wait(spins);
+            }
+        }
+    }
+};
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "book_manager.hpp"
+#include "mapped_file.hpp"
+
+// NASDAQ TotalView-ITCH 5.0. A capture file is a sequence of messages, each preceded by a 2-byte big-endian length.
+// All fields are big-endian, prices are unsigned with four implied decimals. Only the order book messages are
+// decoded, everything else is skipped by its length
+
+inline uint16_t itch_u16(const char* p) noexcept {
+    uint16_t v;
+    std::memcpy(&v, p, 2);
+    return __builtin_bswap16(v);
+}
+
+inline uint32_t itch_u32(const char* p) noexcept {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return __builtin_bswap32(v);
+}
+
+inline uint64_t itch_u48(const char* p) noexcept {
+    return (uint64_t{itch_u16(p)} << 32) | itch_u32(p + 2);
+}
+
+inline uint64_t itch_u64(const char* p) noexcept {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return __builtin_bswap64(v);
+}
+
+// Decoded views, every message also carries stock_locate and a nanoseconds-since-midnight timestamp
+struct ItchAdd { // 'A' and 'F'
+    uint16_t stock_locate;
+    uint64_t timestamp;
+    uint64_t order_ref;
+    bool is_bid;
+    uint32_t shares;
+    uint32_t price;
+    const char* stock; // 8 characters, space padded, points into the message
+};
+
+struct ItchExecute { // 'E' and 'C', the price is only set for 'C'
+    uint16_t stock_locate;
+    uint64_t timestamp;
+    uint64_t order_ref;
+    uint32_t shares;
+    uint64_t match_number;
+    uint32_t price;
+};
+
+struct ItchCancel { // 'X', partial
+    uint16_t stock_locate;
+    uint64_t timestamp;
+    uint64_t order_ref;
+    uint32_t shares;
+};
+
+struct ItchDelete { // 'D'
+    uint16_t stock_locate;
+    uint64_t timestamp;
+    uint64_t order_ref;
+};
+
+struct ItchReplace { // 'U', the new order keeps the side of the original
+    uint16_t stock_locate;
+    uint64_t timestamp;
+    uint64_t original_ref;
+    uint64_t new_ref;
+    uint32_t shares;
+    uint32_t price;
+};
+
+// Message sizes without the length prefix
+enum : uint16_t {
+    ITCH_ADD_SIZE = 36,
+    ITCH_ADD_MPID_SIZE = 40,
+    ITCH_EXECUTE_SIZE = 31,
+    ITCH_EXECUTE_PRICE_SIZE = 36,
+    ITCH_CANCEL_SIZE = 23,
+    ITCH_DELETE_SIZE = 19,
+    ITCH_REPLACE_SIZE = 35,
+};
+
+template <typename Handler, typename Message>
+inline void itch_deliver(Handler& handler, const Message& message) {
+    if constexpr (std::is_invocable_v<Handler&, const Message&>) handler(message);
+}
+
+// Decodes straight out of data and hands each book message to the handler overload that takes it, a handler without
+// one for some type skips it at compile time. Returns the messages walked, a truncated message at the end is left out
+template <typename Handler>
+size_t parse_itch(const char* data, size_t size, Handler& handler) {
+    size_t count = 0;
+    const char* p = data;
+    const char* end = data + size;
+    while (end - p >= 2) {
+        uint16_t length = itch_u16(p);
+        if (length == 0 || static_cast<size_t>(end - p - 2) < length) break;
+        const char* m = p + 2;
+        p += 2 + length;
+        ++count;
+        if (length < 11) continue; // Too short for the common header
+        uint16_t locate = itch_u16(m + 1);
+        uint64_t timestamp = itch_u48(m + 5);
+        switch (m[0]) {
+            case 'A':
+            case 'F':
+                if (length < ITCH_ADD_SIZE) break;
+                itch_deliver(handler, ItchAdd{
+                    locate, timestamp, itch_u64(m + 11), m[19] == 'B', itch_u32(m + 20), itch_u32(m + 32), m + 24
+                });
+                break;
+            case 'E':
+                if (length < ITCH_EXECUTE_SIZE) break;
+                itch_deliver(handler, ItchExecute{locate, timestamp, itch_u64(m + 11), itch_u32(m + 19), itch_u64(m + 23), 0});
+                break;
+            case 'C':
+                if (length < ITCH_EXECUTE_PRICE_SIZE) break;
+                itch_deliver(handler, ItchExecute{
+                    locate, timestamp, itch_u64(m + 11), itch_u32(m + 19), itch_u64(m + 23), itch_u32(m + 32)
+                });
+                break;
+            case 'X':
+                if (length < ITCH_CANCEL_SIZE) break;
+                itch_deliver(handler, ItchCancel{locate, timestamp, itch_u64(m + 11), itch_u32(m + 19)});
+                break;
+            case 'D':
+                if (length < ITCH_DELETE_SIZE) break;
+                itch_deliver(handler, ItchDelete{locate, timestamp, itch_u64(m + 11)});
+                break;
+            case 'U':
+                if (length < ITCH_REPLACE_SIZE) break;
+                itch_deliver(handler, ItchReplace{
+                    locate, timestamp, itch_u64(m + 11), itch_u64(m + 19), itch_u32(m + 27), itch_u32(m + 31)
+                });
+                break;
+            default:
+                break;
+        }
+    }
+    return count;
+}
+
+// Read-only mapping of a capture file
+struct ItchFile {
+    MappedFile file_;
+
+    bool open(const char* path) { return file_.open(path); }
+    void close() noexcept { file_.close(); }
+
+    template <typename Handler>
+    size_t parse(Handler& handler) const { return parse_itch(file_.data(), file_.size(), handler); }
+};
+
+// Encodes length-prefixed ITCH 5.0 messages, for synthetic sample files. Tracking numbers are left at zero
+struct ItchWriter {
+    std::vector<char> buffer_;
+
+    void put16(uint16_t v) { v = __builtin_bswap16(v); append(&v, 2); }
+    void put32(uint32_t v) { v = __builtin_bswap32(v); append(&v, 4); }
+    void put48(uint64_t v) { put16(static_cast<uint16_t>(v >> 32)); put32(static_cast<uint32_t>(v)); }
+    void put64(uint64_t v) { v = __builtin_bswap64(v); append(&v, 8); }
+    void append(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        buffer_.insert(buffer_.end(), bytes, bytes + size);
+    }
+
+    void begin(uint16_t length, char type, uint16_t locate, uint64_t timestamp) {
+        put16(length);
+        buffer_.push_back(type);
+        put16(locate);
+        put16(0);
+        put48(timestamp);
+    }
+
+    void system_event(uint64_t timestamp, char code) {
+        begin(12, 'S', 0, timestamp);
+        buffer_.push_back(code);
+    }
+
+    void add(uint16_t locate, uint64_t timestamp, uint64_t ref, bool is_bid, uint32_t shares, const char* stock,
+             uint32_t price) {
+        begin(ITCH_ADD_SIZE, 'A', locate, timestamp);
+        put64(ref);
+        buffer_.push_back(is_bid ? 'B' : 'S');
+        put32(shares);
+        append(stock, 8);
+        put32(price);
+    }
+
+    void execute(uint16_t locate, uint64_t timestamp, uint64_t ref, uint32_t shares, uint64_t match_number) {
+        begin(ITCH_EXECUTE_SIZE, 'E', locate, timestamp);
+        put64(ref);
+        put32(shares);
+        put64(match_number);
+    }
+
+    void cancel(uint16_t locate, uint64_t timestamp, uint64_t ref, uint32_t shares) {
+        begin(ITCH_CANCEL_SIZE, 'X', locate, timestamp);
+        put64(ref);
+        put32(shares);
+    }
+
+    void remove(uint16_t locate, uint64_t timestamp, uint64_t ref) {
+        begin(ITCH_DELETE_SIZE, 'D', locate, timestamp);
+        put64(ref);
+    }
+
+    void replace(uint16_t locate, uint64_t timestamp, uint64_t original_ref, uint64_t new_ref, uint32_t shares,
+                 uint32_t price) {
+        begin(ITCH_REPLACE_SIZE, 'U', locate, timestamp);
+        put64(original_ref);
+        put64(new_ref);
+        put32(shares);
+        put32(price);
+    }
+
+    bool save(const char* path) const {
+        int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        size_t written = 0;
+        while (written < buffer_.size()) {
+            ssize_t n = ::write(fd, buffer_.data() + written, buffer_.size() - written);
+            if (n <= 0) break;
+            written += static_cast<size_t>(n);
+        }
+        ::close(fd);
+        return written == buffer_.size();
+    }
+};
+
+// First pass over a capture, sizes one book per stock locate from the orders that symbol will see
+struct ItchSymbolScan {
+    struct Stats {
+        uint32_t first_price = 0;
+        size_t orders = 0;
+        bool sub_penny = false;
+    };
+
+    std::vector<Stats> stats_ = std::vector<Stats>(size_t{1} << 16);
+
+    void note(uint16_t locate, uint32_t price) noexcept {
+        Stats& stats = stats_[locate];
+        if (stats.orders++ == 0) stats.first_price = price;
+        stats.sub_penny |= price % 100 != 0;
+    }
+
+    void operator()(const ItchAdd& message) noexcept { note(message.stock_locate, message.price); }
+    void operator()(const ItchReplace& message) noexcept { note(message.stock_locate, message.price); }
+
+    // Stock locate becomes the symbol ID. Ticks are a cent unless the symbol trades below that, the dense window
+    // spans window_ticks ticks around the first price seen and max_orders is every order the symbol ever gets
+    std::vector<SymbolConfig> configs(size_t window_ticks = 4'096) const {
+        std::vector<SymbolConfig> configs;
+        for (size_t locate = 0; locate < stats_.size(); ++locate) {
+            const Stats& stats = stats_[locate];
+            if (stats.orders == 0) continue;
+            size_t tick = stats.sub_penny ? 1 : 100;
+            size_t half = window_ticks / 2 * tick;
+            size_t price_min = stats.first_price > half ? stats.first_price - half : 0;
+            configs.push_back(SymbolConfig{
+                static_cast<uint32_t>(locate), price_min, price_min + (window_ticks - 1) * tick, tick, stats.orders
+            });
+        }
+        return configs;
+    }
+};
+
+// Second pass, replays the feed's order messages into one book per stock locate. The feed already did the matching,
+// so adds never cross and executions and cancels both just take shares off the resting order. A replace is a delete
+// and an add on the same side under the new reference. Messages for unknown symbols or orders are counted and skipped
+template <typename Layout, typename Sink>
+struct ItchBookDriver {
+    using Manager = BookManager<Layout>;
+    using Book = typename Manager::Book;
+
+    Manager& manager_;
+    Sink& sink_;
+    size_t skipped_ = 0;
+
+    ItchBookDriver(Manager& manager, Sink& sink) : manager_(manager), sink_(sink) {}
+
+    Book* book_for(uint16_t locate) noexcept {
+        uint32_t dense = manager_.dense_id(locate);
+        if (dense == Manager::NO_BOOK) {
+            ++skipped_;
+            return nullptr;
+        }
+        return &manager_.book(dense);
+    }
+
+    void reduce(uint16_t locate, uint64_t order_ref, uint32_t shares) {
+        Book* book = book_for(locate);
+        if (!book) return;
+        auto* entry = book->index_.find(order_ref);
+        if (!entry) {
+            ++skipped_;
+            return;
+        }
+        const auto& order = book->pool_.at(entry->order_);
+        size_t price = order.price_, quantity = order.quantity_;
+        if (shares >= quantity) {
+            book->cancel_order(order_ref, sink_);
+        } else {
+            book->modify_order(order_ref, price, quantity - shares, sink_);
+        }
+    }
+
+    void operator()(const ItchAdd& message) {
+        Book* book = book_for(message.stock_locate);
+        if (book) book->submit_order(message.price, message.shares, message.order_ref, message.is_bid, sink_);
+    }
+
+    void operator()(const ItchExecute& message) { reduce(message.stock_locate, message.order_ref, message.shares); }
+    void operator()(const ItchCancel& message) { reduce(message.stock_locate, message.order_ref, message.shares); }
+
+    void operator()(const ItchDelete& message) {
+        Book* book = book_for(message.stock_locate);
+        if (book && !book->cancel_order(message.order_ref, sink_)) ++skipped_;
+    }
+
+    void operator()(const ItchReplace& message) {
+        Book* book = book_for(message.stock_locate);
+        if (!book) return;
+        auto* entry = book->index_.find(message.original_ref);
+        if (!entry) {
+            ++skipped_;
+            return;
+        }
+        bool is_bid = entry->is_bid_;
+        book->cancel_order(message.original_ref, sink_);
+        book->submit_order(message.price, message.shares, message.new_ref, is_bid, sink_);
+    }
+};
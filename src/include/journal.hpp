@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "checksum.hpp"
+#include "mapped_file.hpp"
+#include "orderbook.hpp"
+
+// One journalled command, fixed size so a reader can index records directly. The checksum covers every byte before
+// it, a record that fails it marks the end of the journal (torn write or never written)
+struct JournalRecord {
+    uint64_t sequence;
+    uint64_t id;
+    uint64_t price;
+    uint64_t quantity;
+    uint32_t symbol;
+    uint8_t type; // CommandType
+    uint8_t is_bid;
+    uint16_t reserved;
+    uint32_t checksum;
+    uint32_t reserved2;
+
+    static JournalRecord make(uint64_t sequence, const OrderCmd& command) noexcept {
+        JournalRecord record{
+            sequence, command.id, command.price, command.quantity, command.symbol,
+            static_cast<uint8_t>(command.type), command.is_bid, 0, 0, 0
+        };
+        record.checksum = record.compute_checksum();
+        return record;
+    }
+
+    uint32_t compute_checksum() const noexcept { return crc32c(0, this, offsetof(JournalRecord, checksum)); }
+
+    bool valid(uint64_t expected_sequence) const noexcept {
+        return sequence == expected_sequence && checksum == compute_checksum() && type <= 2;
+    }
+
+    OrderCmd command() const noexcept {
+        return OrderCmd{static_cast<CommandType>(type), is_bid != 0, symbol, id, price, quantity};
+    }
+};
+static_assert(sizeof(JournalRecord) == 48);
+
+struct JournalHeader {
+    static constexpr char MAGIC[8] = {'L', 'O', 'B', 'J', 'R', 'N', 'L', '1'};
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t first_sequence;
+    char padding[40];
+};
+static_assert(sizeof(JournalHeader) == 64);
+
+struct JournalOptions {
+    size_t group_records = 64; // Records per automatic msync, 1 syncs every record and 0 only syncs on commit()
+    size_t initial_bytes = size_t{64} << 20; // Mapped up front, doubled whenever it fills up
+};
+
+// Append-only command journal in a shared file mapping. Records are copied into the mapping and made durable with
+// one msync per group, so the sync cost is paid once per group_records commands. Log a batch, commit() it and only
+// then act on it, a command is durable once commit() (or the append that completed its group) has returned
+struct Journal {
+    int fd_ = -1;
+    char* map_ = nullptr;
+    size_t capacity_ = 0; // Mapped and allocated bytes
+    size_t size_ = 0; // Bytes written, header included
+    size_t synced_ = 0; // Bytes known to be on disk
+    size_t pending_ = 0; // Records appended since the last sync
+    uint64_t sequence_ = 0;
+    size_t syncs_ = 0;
+    JournalOptions options_;
+
+    Journal() = default;
+    ~Journal() { close(); }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Creates a new journal at path, replacing any file there. False if the file cannot be created or mapped
+    bool open(const char* path, JournalOptions options = {}, uint64_t first_sequence = 0) {
+        close();
+        options_ = options;
+        fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) return false;
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        capacity_ = std::max(page, (options.initial_bytes + page - 1) / page * page);
+        if (ftruncate(fd_, static_cast<off_t>(capacity_)) != 0) return fail();
+        void* memory = mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (memory == MAP_FAILED) return fail();
+        map_ = static_cast<char*>(memory);
+
+        JournalHeader header{};
+        std::memcpy(header.magic, JournalHeader::MAGIC, sizeof(header.magic));
+        header.record_size = sizeof(JournalRecord);
+        header.first_sequence = first_sequence;
+        std::memcpy(map_, &header, sizeof(header));
+        size_ = sizeof(header);
+        sequence_ = first_sequence;
+        return commit();
+    }
+
+    // Syncs what is left and cuts the file down to the records written
+    void close() noexcept {
+        if (fd_ < 0) return;
+        if (map_) {
+            commit();
+            munmap(map_, capacity_);
+            map_ = nullptr;
+            if (ftruncate(fd_, static_cast<off_t>(size_)) == 0) fdatasync(fd_);
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    uint64_t sequence() const noexcept { return sequence_; }
+    size_t size() const noexcept { return size_; }
+
+    // False if the journal is not open or cannot grow, nothing is written then
+    bool append(const OrderCmd& command) noexcept {
+        if (size_ + sizeof(JournalRecord) > capacity_ && !grow()) return false;
+        JournalRecord record = JournalRecord::make(sequence_++, command);
+        std::memcpy(map_ + size_, &record, sizeof(record));
+        size_ += sizeof(record);
+        if (options_.group_records > 0 && ++pending_ >= options_.group_records) return commit();
+        return true;
+    }
+
+    bool append(const OrderCmd* commands, size_t count) noexcept {
+        for (size_t i = 0; i < count; ++i) {
+            if (!append(commands[i])) return false;
+        }
+        return true;
+    }
+
+    // Waits until everything appended so far is on disk, whatever group_records is
+    bool commit() noexcept {
+        if (!map_ || synced_ == size_) return map_ != nullptr;
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t from = synced_ / page * page;
+        if (msync(map_ + from, size_ - from, MS_SYNC) != 0) return false;
+        synced_ = size_;
+        pending_ = 0;
+        ++syncs_;
+        return true;
+    }
+
+    // Cold path, doubles the file and the mapping
+    __attribute__((noinline)) bool grow() noexcept {
+        if (!map_) return false;
+        size_t capacity = capacity_ * 2;
+        if (ftruncate(fd_, static_cast<off_t>(capacity)) != 0) return false;
+        void* memory = mremap(map_, capacity_, capacity, MREMAP_MAYMOVE);
+        if (memory == MAP_FAILED) return false;
+        map_ = static_cast<char*>(memory);
+        capacity_ = capacity;
+        return true;
+    }
+
+    bool fail() noexcept {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+};
+
+// Read-only mapping of a journal. Records are checked as they are read, the first one that fails its checksum or
+// breaks the sequence is the end of the journal
+struct JournalReader {
+    MappedFile file_;
+    const JournalRecord* records_ = nullptr;
+    size_t capacity_ = 0; // Whole records in the file, valid or not
+    uint64_t first_sequence_ = 0;
+
+    // False if the file cannot be mapped or does not start with a journal header
+    bool open(const char* path) {
+        close();
+        if (!file_.open(path, sizeof(JournalHeader))) return false;
+        JournalHeader header;
+        std::memcpy(&header, file_.data(), sizeof(header));
+        if (std::memcmp(header.magic, JournalHeader::MAGIC, sizeof(header.magic)) != 0
+            || header.record_size != sizeof(JournalRecord)) {
+            close();
+            return false;
+        }
+        records_ = reinterpret_cast<const JournalRecord*>(file_.data() + sizeof(header));
+        capacity_ = (file_.size() - sizeof(header)) / sizeof(JournalRecord);
+        first_sequence_ = header.first_sequence;
+        return true;
+    }
+
+    void close() noexcept {
+        file_.close();
+        records_ = nullptr;
+        capacity_ = 0;
+    }
+
+    // Decodes up to count valid records starting at sequence into out, returns how many were decoded
+    size_t read(uint64_t sequence, OrderCmd* out, size_t count) const noexcept {
+        if (sequence < first_sequence_) return 0;
+        size_t i = static_cast<size_t>(sequence - first_sequence_);
+        size_t n = 0;
+        for (; n < count && i + n < capacity_; ++n) {
+            const JournalRecord& record = records_[i + n];
+            if (!record.valid(sequence + n)) break;
+            out[n] = record.command();
+        }
+        return n;
+    }
+};
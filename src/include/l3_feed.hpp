@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// ITCH-style order-by-order messages. Each one is a packed struct in host byte order (little endian on x86) that
+// starts with its type character and a feed sequence number, so a reader can walk the buffer by type.
+// Executions only name the resting order, the aggressor never rests and is not part of the feed.
+#pragma pack(push, 1)
+struct L3Add {
+    static constexpr char TYPE = 'A';
+    char type;
+    uint64_t sequence;
+    uint64_t order_id;
+    uint8_t is_bid;
+    uint64_t price;
+    uint64_t quantity;
+};
+
+struct L3Execute {
+    static constexpr char TYPE = 'E';
+    char type;
+    uint64_t sequence;
+    uint64_t order_id;
+    uint64_t quantity; // Executed quantity, the order is gone once all of it has executed
+    uint64_t match_id; // ID of the incoming order it traded with
+};
+
+// Partial cancel, the order keeps its queue position
+struct L3Cancel {
+    static constexpr char TYPE = 'X';
+    char type;
+    uint64_t sequence;
+    uint64_t order_id;
+    uint64_t quantity; // Quantity taken off
+};
+
+struct L3Delete {
+    static constexpr char TYPE = 'D';
+    char type;
+    uint64_t sequence;
+    uint64_t order_id;
+};
+
+// The order moves to a new price and/or size under the same ID and goes to the back of the queue
+struct L3Replace {
+    static constexpr char TYPE = 'U';
+    char type;
+    uint64_t sequence;
+    uint64_t order_id;
+    uint64_t price;
+    uint64_t quantity;
+};
+#pragma pack(pop)
+
+inline size_t l3_message_size(char type) noexcept {
+    switch (type) {
+        case L3Add::TYPE: return sizeof(L3Add);
+        case L3Execute::TYPE: return sizeof(L3Execute);
+        case L3Cancel::TYPE: return sizeof(L3Cancel);
+        case L3Delete::TYPE: return sizeof(L3Delete);
+        case L3Replace::TYPE: return sizeof(L3Replace);
+        default: return 0;
+    }
+}
+
+// Encodes into a buffer allocated once up front. When it fills up the flush callback gets the bytes written so far,
+// without one the overflowing messages are dropped and counted. Dropped messages still use up a sequence number so
+// readers can see the gap
+struct L3Writer {
+    using FlushFn = void (*)(void* context, const char* data, size_t size);
+    static constexpr uint64_t NO_ORDER = std::numeric_limits<uint64_t>::max();
+
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+    uint64_t sequence_ = 0;
+    size_t dropped_ = 0;
+    FlushFn flush_;
+    void* context_;
+    uint64_t replacing_ = NO_ORDER; // Order between begin_replace and end_replace
+
+    explicit L3Writer(size_t capacity, FlushFn flush = nullptr, void* context = nullptr)
+        : buffer_(capacity), flush_(flush), context_(context) {}
+
+    L3Writer(const L3Writer&) = delete;
+    L3Writer& operator=(const L3Writer&) = delete;
+
+    const char* data() const noexcept { return buffer_.data(); }
+    size_t size() const noexcept { return size_; }
+    void clear() noexcept { size_ = 0; }
+
+    void flush() noexcept {
+        if (!flush_) return;
+        if (size_ > 0) flush_(context_, buffer_.data(), size_);
+        size_ = 0;
+    }
+
+    template <typename Message>
+    void write(Message message) noexcept {
+        message.type = Message::TYPE;
+        message.sequence = sequence_++;
+        if (size_ + sizeof(Message) > buffer_.size()) {
+            flush();
+            if (size_ + sizeof(Message) > buffer_.size()) {
+                ++dropped_;
+                return;
+            }
+        }
+        std::memcpy(buffer_.data() + size_, &message, sizeof(Message));
+        size_ += sizeof(Message);
+    }
+
+    void add(uint64_t order_id, bool is_bid, uint64_t price, uint64_t quantity) noexcept {
+        if (order_id == replacing_) {
+            replacing_ = NO_ORDER;
+            write(L3Replace{0, 0, order_id, price, quantity});
+        } else {
+            write(L3Add{0, 0, order_id, is_bid, price, quantity});
+        }
+    }
+
+    void execute(uint64_t order_id, uint64_t quantity, uint64_t match_id) noexcept {
+        write(L3Execute{0, 0, order_id, quantity, match_id});
+    }
+
+    void cancel(uint64_t order_id, uint64_t quantity) noexcept {
+        write(L3Cancel{0, 0, order_id, quantity});
+    }
+
+    void remove(uint64_t order_id) noexcept {
+        if (order_id != replacing_) write(L3Delete{0, 0, order_id});
+    }
+
+    // A cancel and re-entry under the same ID goes out as one replace if the re-entered order rests, and as a delete
+    // if it traded away or was rejected
+    void begin_replace(uint64_t order_id) noexcept { replacing_ = order_id; }
+
+    void end_replace() noexcept {
+        if (replacing_ == NO_ORDER) return;
+        uint64_t order_id = replacing_;
+        replacing_ = NO_ORDER;
+        write(L3Delete{0, 0, order_id});
+    }
+};
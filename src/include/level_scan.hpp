@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+// Kernels that find the next non-zero level quantity, an alternative to the occupancy bitmap that needs no
+// bookkeeping on the hot path. All of them search [from, to) and return to when every quantity in it is zero.
+// The SIMD variants are compiled for their target only, level_scan_kernels() picks one with CPUID at runtime.
+
+inline size_t scan_forward_scalar(const size_t* quantities, size_t from, size_t to) noexcept {
+    for (size_t i = from; i < to; ++i) {
+        if (quantities[i]) return i;
+    }
+    return to;
+}
+
+inline size_t scan_backward_scalar(const size_t* quantities, size_t from, size_t to) noexcept {
+    for (size_t i = to; i-- > from; ) {
+        if (quantities[i]) return i;
+    }
+    return to;
+}
+
+__attribute__((target("avx2")))
+inline size_t scan_forward_avx2(const size_t* quantities, size_t from, size_t to) noexcept {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = from;
+    for (; i + 4 <= to; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(quantities + i));
+        unsigned empty = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, zero))));
+        if (empty != 0xF) return i + static_cast<size_t>(__builtin_ctz(~empty & 0xF));
+    }
+    return scan_forward_scalar(quantities, i, to);
+}
+
+__attribute__((target("avx2")))
+inline size_t scan_backward_avx2(const size_t* quantities, size_t from, size_t to) noexcept {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = to;
+    for (; i >= from + 4; i -= 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(quantities + i - 4));
+        unsigned empty = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, zero))));
+        if (empty != 0xF) return i - 4 + static_cast<size_t>(31 - __builtin_clz(~empty & 0xF));
+    }
+    size_t found = scan_backward_scalar(quantities, from, i);
+    return found == i ? to : found;
+}
+
+__attribute__((target("avx512f")))
+inline size_t scan_forward_avx512(const size_t* quantities, size_t from, size_t to) noexcept {
+    size_t i = from;
+    for (; i + 8 <= to; i += 8) {
+        __m512i v = _mm512_loadu_si512(quantities + i);
+        __mmask8 filled = _mm512_test_epi64_mask(v, v);
+        if (filled) return i + static_cast<size_t>(__builtin_ctz(filled));
+    }
+    return scan_forward_scalar(quantities, i, to);
+}
+
+__attribute__((target("avx512f")))
+inline size_t scan_backward_avx512(const size_t* quantities, size_t from, size_t to) noexcept {
+    size_t i = to;
+    for (; i >= from + 8; i -= 8) {
+        __m512i v = _mm512_loadu_si512(quantities + i - 8);
+        __mmask8 filled = _mm512_test_epi64_mask(v, v);
+        if (filled) return i - 8 + static_cast<size_t>(31 - __builtin_clz(filled));
+    }
+    size_t found = scan_backward_scalar(quantities, from, i);
+    return found == i ? to : found;
+}
+
+using ScanKernel = size_t (*)(const size_t*, size_t, size_t) noexcept;
+
+struct LevelScanKernels {
+    ScanKernel forward_;
+    ScanKernel backward_;
+    const char* name_;
+};
+
+inline LevelScanKernels select_level_scan_kernels() noexcept {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return {scan_forward_avx512, scan_backward_avx512, "avx512"};
+    if (__builtin_cpu_supports("avx2")) return {scan_forward_avx2, scan_backward_avx2, "avx2"};
+    return {scan_forward_scalar, scan_backward_scalar, "scalar"};
+}
+
+inline const LevelScanKernels& level_scan_kernels() noexcept {
+    static const LevelScanKernels kernels = select_level_scan_kernels();
+    return kernels;
+}
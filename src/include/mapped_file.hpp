@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only private mapping of a whole file, advised for sequential reading. Shared by the journal, snapshot and
+// capture readers
+struct MappedFile {
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // False if the file cannot be opened or mapped, or is shorter than min_size (mmap refuses empty files anyway)
+    bool open(const char* path, size_t min_size = 1) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0 || static_cast<size_t>(info.st_size) < min_size) {
+            ::close(fd);
+            return false;
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        void* memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED) return false;
+        madvise(memory, size, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(memory);
+        size_ = size;
+        return true;
+    }
+
+    void close() noexcept {
+        if (data_) munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const char* data() const noexcept { return data_; }
+    size_t size() const noexcept { return size_; }
+};
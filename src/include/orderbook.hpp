@@ -1,21 +1,100 @@
+#pragma once
+
 #include <cstdint>
 #include <cassert>
 #include <algorithm>
+#include <atomic>
 #include <vector>
+#include <map>
+#include <limits>
+#include <type_traits>
 #include <iostream>
 #include <iomanip>
+#include <sys/mman.h>
+#include "level_scan.hpp"
+#include "l3_feed.hpp"
 
-static constexpr size_t MAX_ORDERS = 1'000;
-static constexpr size_t PRICE_MIN = 800;
-static constexpr size_t PRICE_MAX = 1200;
-static constexpr size_t TICK_SIZE = 1;
-static constexpr size_t NUM_LEVELS = (PRICE_MAX - PRICE_MIN) / TICK_SIZE + 1;
+static constexpr size_t ceil_pow2(size_t n) noexcept {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
 
-struct Order {
-    size_t order_id_;
-    size_t price_;
-    size_t quantity_;
-    Order* next_; // Orders will be stored in a linked list, one linked list per price level
+static constexpr size_t log2_pow2(size_t n) noexcept {
+    size_t b = 0;
+    while ((size_t{1} << b) < n) ++b;
+    return b;
+}
+
+// [price_min, price_max] is only the initial dense window of the ladder, prices outside it are still accepted.
+// The window is rounded up to a power of two levels so it can be used as a ring buffer.
+
+// Instrument geometry known at compile time, every accessor folds to a constant in price_to_tick and mask
+template <size_t PriceMin, size_t PriceMax, size_t TickSize, size_t MaxOrders>
+struct StaticInstrument {
+    static_assert(PriceMax >= PriceMin && TickSize > 0 && MaxOrders > 0);
+
+    static constexpr size_t price_min() noexcept { return PriceMin; }
+    static constexpr size_t price_max() noexcept { return PriceMax; }
+    static constexpr size_t tick_size() noexcept { return TickSize; }
+    static constexpr size_t max_orders() noexcept { return MaxOrders; } // Resting orders per book, the pool grows up to this
+    static constexpr size_t num_levels() noexcept { return ceil_pow2((PriceMax - PriceMin) / TickSize + 1); }
+};
+
+// Instrument geometry chosen at runtime, so one book type can host instruments with very different price ranges
+struct RuntimeInstrument {
+    size_t price_min_;
+    size_t price_max_;
+    size_t tick_size_;
+    size_t max_orders_;
+    size_t num_levels_; // Cached, avoids a division on every lookup
+
+    RuntimeInstrument(size_t price_min, size_t price_max, size_t tick_size, size_t max_orders)
+        : price_min_(price_min), price_max_(price_max), tick_size_(tick_size), max_orders_(max_orders),
+          num_levels_(ceil_pow2((price_max - price_min) / tick_size + 1)) {
+        assert(price_max >= price_min && tick_size > 0 && max_orders > 0);
+    }
+
+    size_t price_min() const noexcept { return price_min_; }
+    size_t price_max() const noexcept { return price_max_; }
+    size_t tick_size() const noexcept { return tick_size_; }
+    size_t max_orders() const noexcept { return max_orders_; } // Resting orders per book, the pool grows up to this
+    size_t num_levels() const noexcept { return num_levels_; }
+};
+
+using DefaultInstrument = StaticInstrument<800, 1200, 1, 1'000>;
+
+// Order storage layouts. A layout defines the Order record and the Handle used to link orders together
+
+// Pointer linked orders carrying their own ID, 40 bytes each
+struct PointerLayout {
+    struct Order {
+        size_t order_id_;
+        size_t price_;
+        size_t quantity_;
+        Order* next_; // Orders will be stored in a linked list, one linked list per price level
+        Order* prev_; // Doubly linked so that a cancel can unlink the order in O(1)
+    };
+
+    using Handle = Order*;
+    static constexpr Handle NIL = nullptr;
+    static constexpr bool INDEXED = false;
+};
+
+// Orders linked by 32-bit pool indices, 16 bytes each with the default quantity width. The order ID is only read
+// when reporting a fill or a cancel, so the pool keeps it in a parallel array instead of next to the links
+template <typename Quantity = uint32_t>
+struct CompactLayout {
+    struct Order {
+        Quantity quantity_;
+        uint32_t price_;
+        uint32_t next_;
+        uint32_t prev_;
+    };
+
+    using Handle = uint32_t;
+    static constexpr Handle NIL = std::numeric_limits<uint32_t>::max();
+    static constexpr bool INDEXED = true;
 };
 
 struct Trade {
@@ -25,193 +104,979 @@ struct Trade {
     size_t quantity;
 };
 
+enum class CommandType : uint8_t { New, Cancel, Modify };
+
+// Fixed-size order command, for batches and for passing orders between threads. Cancel only uses id, Modify uses id,
+// price and quantity. symbol is only read when routing between books
+struct OrderCmd {
+    CommandType type;
+    bool is_bid;
+    uint32_t symbol;
+    size_t id;
+    size_t price;
+    size_t quantity;
+};
+
+enum class ExecType : uint8_t { Ack, PartialFill, Fill, Rest, Cancel, Reject };
+enum class RejectReason : uint8_t {
+    None, ZeroQuantity, UnknownOrder, BookFull, DoesNotFit, UnknownSymbol, DuplicateId, OffTick
+};
+
+// One event in the life of an order. quantity is the size of this event (fill, rested or cancelled size), leaves is
+// what is still open afterwards
+struct ExecutionReport {
+    static constexpr size_t NO_ORDER = std::numeric_limits<size_t>::max();
+
+    size_t order_id;
+    size_t contra_order_id; // Other side of a fill, NO_ORDER otherwise
+    size_t price;
+    size_t quantity;
+    size_t leaves_quantity;
+    ExecType type;
+    RejectReason reason;
+    bool is_bid;
+};
+
+// Top of book, prices are 0 for an empty side
+struct Bbo {
+    size_t bid_price;
+    size_t bid_quantity;
+    size_t ask_price;
+    size_t ask_quantity;
+
+    bool operator==(const Bbo& other) const noexcept {
+        return bid_price == other.bid_price && bid_quantity == other.bid_quantity
+            && ask_price == other.ask_price && ask_quantity == other.ask_quantity;
+    }
+    bool operator!=(const Bbo& other) const noexcept { return !(*this == other); }
+};
+
+// BBO shared with other threads through a seqlock. The matching thread is the only writer and never waits, readers
+// retry while a write is in progress. It sits alone on its cache line so the matching thread's other data never
+// bounces to the readers
+struct alignas(64) PublishedBbo {
+    std::atomic<uint64_t> sequence_{0}; // Odd while a write is in progress
+    std::atomic<size_t> bid_price_{0};
+    std::atomic<size_t> bid_quantity_{0};
+    std::atomic<size_t> ask_price_{0};
+    std::atomic<size_t> ask_quantity_{0};
+
+    // Writer only, skips the write when nothing changed so readers' copies of the line stay valid
+    void publish(const Bbo& bbo) noexcept {
+        if (bid_price_.load(std::memory_order_relaxed) == bbo.bid_price
+            && bid_quantity_.load(std::memory_order_relaxed) == bbo.bid_quantity
+            && ask_price_.load(std::memory_order_relaxed) == bbo.ask_price
+            && ask_quantity_.load(std::memory_order_relaxed) == bbo.ask_quantity) {
+            return;
+        }
+        uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bid_price_.store(bbo.bid_price, std::memory_order_relaxed);
+        bid_quantity_.store(bbo.bid_quantity, std::memory_order_relaxed);
+        ask_price_.store(bbo.ask_price, std::memory_order_relaxed);
+        ask_quantity_.store(bbo.ask_quantity, std::memory_order_relaxed);
+        sequence_.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Any thread, returns a consistent snapshot
+    Bbo load() const noexcept {
+        for (;;) {
+            uint64_t before = sequence_.load(std::memory_order_acquire);
+            if (before & 1) {
+                __builtin_ia32_pause();
+                continue;
+            }
+            Bbo bbo{
+                bid_price_.load(std::memory_order_relaxed),
+                bid_quantity_.load(std::memory_order_relaxed),
+                ask_price_.load(std::memory_order_relaxed),
+                ask_quantity_.load(std::memory_order_relaxed)
+            };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence_.load(std::memory_order_relaxed) == before) return bbo;
+        }
+    }
+};
+
+// New total of a level that changed, 0 means the level is gone
+struct LevelUpdate {
+    size_t price;
+    size_t quantity;
+    bool is_bid;
+};
+
+// Conflated L2 changes of one input message. levels points into the book and is valid until its next message
+struct BookDelta {
+    const LevelUpdate* levels;
+    size_t num_levels;
+    Bbo bbo;
+    bool bbo_changed; // Relative to the last published delta
+};
+
+// Fills are handed to a sink, which is anything callable with a const Trade&. A lambda works, these cover the
+// common cases without any allocation on the matching path
+
+// Appends to a caller-owned vector, what submit_order used to do
+struct VectorTradeSink {
+    std::vector<Trade>& trades_;
+
+    void operator()(const Trade& trade) { trades_.push_back(trade); }
+};
+
+// Writes into fixed caller-owned storage, fills past the end are only counted
+struct SpanTradeSink {
+    Trade* data_;
+    size_t capacity_;
+    size_t size_ = 0;
+    size_t dropped_ = 0;
+
+    SpanTradeSink(Trade* data, size_t capacity) noexcept : data_(data), capacity_(capacity) {}
+
+    void operator()(const Trade& trade) noexcept {
+        if (size_ < capacity_) data_[size_++] = trade;
+        else ++dropped_;
+    }
+    void clear() noexcept { size_ = 0; dropped_ = 0; }
+};
+
+// Single-threaded ring of the last N fills, overwrites the oldest when the consumer falls behind
+template <size_t N>
+struct TradeRing {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+    Trade trades_[N];
+    size_t head_ = 0; // Total fills written
+    size_t tail_ = 0; // Total fills consumed
+
+    void operator()(const Trade& trade) noexcept {
+        trades_[head_ & (N - 1)] = trade;
+        if (++head_ - tail_ > N) tail_ = head_ - N;
+    }
+    bool pop(Trade& out) noexcept {
+        if (tail_ == head_) return false;
+        out = trades_[tail_++ & (N - 1)];
+        return true;
+    }
+    size_t size() const noexcept { return head_ - tail_; }
+};
+
+// A sink that is also callable with a const ExecutionReport& receives the full event stream, anything it does not
+// accept is skipped at compile time so plain trade sinks pay nothing for the reports
+template <typename Sink>
+inline void deliver(Sink& sink, const Trade& trade) {
+    if constexpr (std::is_invocable_v<Sink&, const Trade&>) sink(trade);
+}
+
+template <typename Sink>
+inline void deliver(Sink& sink, const ExecutionReport& report) {
+    if constexpr (std::is_invocable_v<Sink&, const ExecutionReport&>) sink(report);
+}
+
+template <typename Sink>
+inline constexpr bool WANTS_DELTAS = std::is_invocable_v<Sink&, const BookDelta&>;
+
 
 // All
+struct PoolOptions {
+    size_t chunk_orders_ = size_t{1} << 16; // Orders per slab chunk
+    bool huge_pages_ = false; // Ask for transparent huge pages on each chunk
+};
+
+// Slab allocator, grows in pre-faulted chunks that are never moved so orders stay put.
+// allocate() returns NIL only once max_orders are live or the OS refuses a new chunk
+template <typename Layout>
 struct OrderPool {
-    Order pool_[MAX_ORDERS]; // Pre-allocate the order pool
-    Order* next_free_; // Next available order pointer that can be used
+    using Order = typename Layout::Order;
+    using Handle = typename Layout::Handle;
+    static constexpr Handle NIL = Layout::NIL;
+    static_assert(sizeof(Order) % alignof(size_t) == 0, "Order IDs are stored right after the orders of a chunk");
+
+    std::vector<Order*> chunks_;
+    std::vector<size_t*> chunk_ids_; // Order IDs of each chunk, indexed layouts only
+    size_t chunk_orders_; // Power of two so an index splits into chunk and offset with a shift and a mask
+    size_t chunk_shift_;
+    size_t max_orders_;
+    size_t capacity_ = 0; // Orders across all chunks
+    bool huge_pages_;
+    Handle next_free_ = NIL; // Next available order that can be used
+
+    explicit OrderPool(size_t max_orders, const PoolOptions& options = PoolOptions{})
+        : chunk_orders_(ceil_pow2(std::min(options.chunk_orders_, max_orders))),
+          chunk_shift_(log2_pow2(chunk_orders_)),
+          max_orders_(max_orders),
+          huge_pages_(options.huge_pages_) {
+        assert(chunk_orders_ > 0);
+        if constexpr (Layout::INDEXED) assert(max_orders < static_cast<size_t>(NIL));
+        grow(); // Pre-allocate the first chunk
+    }
+
+    OrderPool(const OrderPool&) = delete;
+    OrderPool& operator=(const OrderPool&) = delete;
+
+    ~OrderPool() {
+        for (Order* chunk : chunks_) {
+            munmap(chunk, mapped_bytes());
+        }
+    }
+
+    static constexpr size_t HUGE_PAGE = size_t{2} << 20;
 
-    OrderPool() {
-        for (size_t i = 0; i < MAX_ORDERS - 1; ++i) {
-            pool_[i].next_ = &pool_[i + 1]; 
+    size_t chunk_bytes() const noexcept {
+        return chunk_orders_ * (sizeof(Order) + (Layout::INDEXED ? sizeof(size_t) : 0));
+    }
+
+    // Huge page chunks are rounded up to whole 2MB pages
+    size_t mapped_bytes() const noexcept {
+        return huge_pages_ ? (chunk_bytes() + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE : chunk_bytes();
+    }
+    size_t capacity() const noexcept { return capacity_; }
+
+    inline Order& at(Handle handle) const noexcept {
+        if constexpr (Layout::INDEXED) {
+            return chunks_[handle >> chunk_shift_][handle & (chunk_orders_ - 1)];
+        } else {
+            return *handle;
+        }
+    }
+
+    inline size_t id(Handle handle) const noexcept {
+        if constexpr (Layout::INDEXED) {
+            return chunk_ids_[handle >> chunk_shift_][handle & (chunk_orders_ - 1)];
+        } else {
+            return handle->order_id_;
+        }
+    }
+
+    inline void set_id(Handle handle, size_t id) noexcept {
+        if constexpr (Layout::INDEXED) {
+            chunk_ids_[handle >> chunk_shift_][handle & (chunk_orders_ - 1)] = id;
+        } else {
+            handle->order_id_ = id;
+        }
+    }
+
+    Handle allocate() noexcept {
+        if (next_free_ == NIL && (capacity_ == max_orders_ || !grow())) return NIL;
+        Handle handle = next_free_;
+        Order& order = at(handle);
+        next_free_ = order.next_;
+        order.next_ = NIL;
+        order.prev_ = NIL;
+        return handle;
+    }
+
+    void deallocate(Handle handle) noexcept {
+        at(handle).next_ = next_free_;
+        next_free_ = handle;
+    }
+
+    // Cold path, maps one more chunk and threads it onto the free list
+    __attribute__((noinline)) bool grow() noexcept {
+        size_t count = std::min(chunk_orders_, max_orders_ - capacity_);
+        if (count == 0) return false;
+
+        void* memory = huge_pages_ ? map_huge_chunk() : map_chunk();
+        if (!memory) return false;
+        Order* chunk = static_cast<Order*>(memory);
+        try {
+            chunks_.push_back(chunk);
+            chunk_ids_.push_back(reinterpret_cast<size_t*>(chunk + chunk_orders_));
+        } catch (...) {
+            if (chunks_.size() > chunk_ids_.size()) chunks_.pop_back();
+            munmap(memory, mapped_bytes());
+            return false;
+        }
+
+        size_t first = (chunks_.size() - 1) << chunk_shift_;
+        for (size_t i = 0; i < count - 1; ++i) {
+            chunk[i].next_ = handle_of(chunk, first, i + 1);
+        }
+        chunk[count - 1].next_ = next_free_;
+        next_free_ = handle_of(chunk, first, 0);
+        capacity_ += count;
+        return true;
+    }
+
+    // Pre-faulted so first use of an order never page faults on the hot path
+    void* map_chunk() noexcept {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        void* memory = mmap(nullptr, chunk_bytes(), PROT_READ | PROT_WRITE, flags, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+
+    // Mapped 2MB aligned and left unpopulated until after the madvise, otherwise the populate would already have
+    // faulted the chunk in as 4K pages
+    void* map_huge_chunk() noexcept {
+        size_t bytes = mapped_bytes();
+        void* memory = mmap(nullptr, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return nullptr;
+        char* raw = static_cast<char*>(memory);
+        char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+        if (aligned > raw) munmap(raw, static_cast<size_t>(aligned - raw));
+        size_t tail = static_cast<size_t>(raw + bytes + HUGE_PAGE - (aligned + bytes));
+        if (tail > 0) munmap(aligned + bytes, tail);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(aligned, bytes, MADV_POPULATE_WRITE) == 0) return aligned;
+#endif
+        for (size_t offset = 0; offset < bytes; offset += 4'096) aligned[offset] = 0; // Older kernels
+        return aligned;
+    }
+
+    static inline Handle handle_of(Order* chunk, size_t first, size_t i) noexcept {
+        if constexpr (Layout::INDEXED) {
+            return static_cast<Handle>(first + i);
+        } else {
+            return &chunk[i];
+        }
+    }
+};
+
+// Open addressing hash table from order ID to resting order, used to find an order without walking the levels
+template <typename Layout>
+struct OrderIndex {
+    using Handle = typename Layout::Handle;
+    static constexpr Handle NIL = Layout::NIL;
+
+    struct Entry {
+        size_t order_id_;
+        Handle order_; // NIL marks an empty slot
+        bool is_bid_;
+    };
+
+    std::vector<Entry> table_;
+    size_t mask_;
+    size_t shift_;
+    size_t size_ = 0;
+
+    // Sized for initial_entries resting orders, doubles whenever the load factor would pass 1/2
+    explicit OrderIndex(size_t initial_entries)
+        : table_(ceil_pow2(2 * initial_entries), Entry{0, NIL, false}),
+          mask_(table_.size() - 1),
+          shift_(64 - log2_pow2(table_.size())) {}
+
+    inline size_t slot_for(size_t order_id) const noexcept {
+        // Fibonacci hashing, order IDs tend to be sequential
+        return static_cast<size_t>((static_cast<uint64_t>(order_id) * 11400714819323198485ull) >> shift_);
+    }
+
+    void prefetch(size_t order_id) const noexcept {
+        __builtin_prefetch(&table_[slot_for(order_id)], 1);
+    }
+
+    Entry* find(size_t order_id) noexcept {
+        for (size_t i = slot_for(order_id); table_[i].order_ != NIL; i = (i + 1) & mask_) {
+            if (table_[i].order_id_ == order_id) return &table_[i];
+        }
+        return nullptr;
+    }
+
+    bool insert(size_t order_id, Handle order, bool is_bid) noexcept {
+        if (2 * (size_ + 1) > table_.size()) rehash(2 * table_.size());
+        size_t i = slot_for(order_id);
+        for (; table_[i].order_ != NIL; i = (i + 1) & mask_) {
+            if (table_[i].order_id_ == order_id) return false; // ID is already resting
         }
-        pool_[MAX_ORDERS - 1].next_ = nullptr;
-        next_free_ = &pool_[0];
+        table_[i] = Entry{order_id, order, is_bid};
+        ++size_;
+        return true;
     }
 
-    Order* allocate() noexcept {
-        if (!next_free_) return nullptr;
-        Order* order = next_free_;
-        next_free_ = next_free_->next_;
-        order->next_ = nullptr;
-        return order;
+    __attribute__((noinline)) void rehash(size_t capacity) noexcept {
+        std::vector<Entry> old(capacity, Entry{0, NIL, false});
+        old.swap(table_);
+        mask_ = table_.size() - 1;
+        shift_ = 64 - log2_pow2(table_.size());
+        for (const Entry& entry : old) {
+            if (entry.order_ == NIL) continue;
+            size_t i = slot_for(entry.order_id_);
+            while (table_[i].order_ != NIL) i = (i + 1) & mask_;
+            table_[i] = entry;
+        }
     }
 
-    void deallocate(Order* order) noexcept {
-        order->next_ = next_free_;
-        next_free_ = order;
+    void erase(Entry* entry) noexcept {
+        // Backward shift deletion, keeps probe sequences intact without tombstones
+        size_t hole = static_cast<size_t>(entry - table_.data());
+        for (size_t i = (hole + 1) & mask_; table_[i].order_ != NIL; i = (i + 1) & mask_) {
+            size_t home = slot_for(table_[i].order_id_);
+            if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+                table_[hole] = table_[i];
+                hole = i;
+            }
+        }
+        table_[hole].order_ = NIL;
+        --size_;
     }
 
+    void erase(size_t order_id) noexcept {
+        Entry* entry = find(order_id);
+        if (entry) erase(entry);
+    }
 };
 
+// Three layer bitset over the price levels, bit i of a layer is set if word i of the layer below is non-zero.
+// Finding the next non-empty level is a tzcnt/lzcnt per layer instead of a scan over the level quantities
+struct LevelBitmap {
+    size_t size_;
+    std::vector<uint64_t> l0_;
+    std::vector<uint64_t> l1_;
+    std::vector<uint64_t> l2_; // A single word up to 2^18 levels
+
+    explicit LevelBitmap(size_t size)
+        : size_(size), l0_((size + 63) / 64), l1_((l0_.size() + 63) / 64), l2_((l1_.size() + 63) / 64) {}
+
+    static inline uint64_t bit(size_t i) noexcept { return uint64_t{1} << (i & 63); }
+    static inline uint64_t from_bit(size_t i) noexcept { return ~uint64_t{0} << (i & 63); } // Bits >= i
+    static inline uint64_t upto_bit(size_t i) noexcept { return ~uint64_t{0} >> (63 - (i & 63)); } // Bits <= i
+    static inline size_t lowest(uint64_t w) noexcept { return static_cast<size_t>(__builtin_ctzll(w)); }
+    static inline size_t highest(uint64_t w) noexcept { return static_cast<size_t>(63 - __builtin_clzll(w)); }
+
+    void set(size_t i) noexcept {
+        l0_[i >> 6] |= bit(i);
+        l1_[i >> 12] |= bit(i >> 6);
+        l2_[i >> 18] |= bit(i >> 12);
+    }
+
+    void clear(size_t i) noexcept {
+        if ((l0_[i >> 6] &= ~bit(i))) return;
+        if ((l1_[i >> 12] &= ~bit(i >> 6))) return;
+        l2_[i >> 18] &= ~bit(i >> 12);
+    }
+
+    // Lowest set index >= i, size_ if there is none
+    size_t next(size_t i) const noexcept {
+        if (i >= size_) return size_;
+        size_t w0 = i >> 6;
+        uint64_t bits = l0_[w0] & from_bit(i);
+        if (bits) return (w0 << 6) | lowest(bits);
+
+        size_t j = w0 + 1; // First l0 word still to check
+        size_t w1 = j >> 6;
+        if (w1 < l1_.size()) {
+            bits = l1_[w1] & from_bit(j);
+            if (bits) {
+                w0 = (w1 << 6) | lowest(bits);
+                return (w0 << 6) | lowest(l0_[w0]);
+            }
+        }
+
+        size_t k = w1 + 1; // First l1 word still to check
+        for (size_t w2 = k >> 6; w2 < l2_.size(); ++w2) {
+            bits = l2_[w2];
+            if (w2 == (k >> 6)) bits &= from_bit(k);
+            if (bits) {
+                w1 = (w2 << 6) | lowest(bits);
+                w0 = (w1 << 6) | lowest(l1_[w1]);
+                return (w0 << 6) | lowest(l0_[w0]);
+            }
+        }
+        return size_;
+    }
+
+    // Highest set index <= i, size_ if there is none
+    size_t prev(size_t i) const noexcept {
+        assert(i < size_);
+        size_t w0 = i >> 6;
+        uint64_t bits = l0_[w0] & upto_bit(i);
+        if (bits) return (w0 << 6) | highest(bits);
+        if (w0 == 0) return size_;
+
+        size_t j = w0 - 1; // Last l0 word still to check
+        size_t w1 = j >> 6;
+        bits = l1_[w1] & upto_bit(j);
+        if (bits) {
+            w0 = (w1 << 6) | highest(bits);
+            return (w0 << 6) | highest(l0_[w0]);
+        }
+        if (w1 == 0) return size_;
+
+        size_t k = w1 - 1; // Last l1 word still to check
+        for (size_t w2 = (k >> 6) + 1; w2-- > 0; ) {
+            bits = l2_[w2];
+            if (w2 == (k >> 6)) bits &= upto_bit(k);
+            if (bits) {
+                w1 = (w2 << 6) | highest(bits);
+                w0 = (w1 << 6) | highest(l1_[w1]);
+                return (w0 << 6) | highest(l0_[w0]);
+            }
+        }
+        return size_;
+    }
+};
+
+enum class Side : uint8_t { Bid, Ask };
+
+// How a side finds the next non-empty level once its best level empties
+enum class LevelSearch : uint8_t {
+    Bitmap, // Hierarchical occupancy bitmap, maintained on every level fill and depletion
+    Scan // SIMD scan over the level quantities, no bookkeeping
+};
+
+// A price level outside the dense window, or one being moved in or out of it
+template <typename Layout>
 struct PriceLevel {
+    using Handle = typename Layout::Handle;
+
     size_t price_;
     size_t total_quantity_; // Total liquidity at this price level
-    Order* first_; // First order that came in at this price level
-    Order* last_; // Last order that came in at this price level
+    Handle first_; // First order that came in at this price level
+    Handle last_; // Last order that came in at this price level
+    uint32_t order_count_; // Orders resting at this price level
 };
 
+// The dense window is a ring buffer over num_levels() consecutive ticks starting at base_tick_, the level for tick t
+// lives in slot t & mask. The best price is always kept inside the window, levels that fall outside it are spilled
+// into overflow_ and pulled back in when the window is recentered over them.
+// Dense levels are stored as parallel arrays so that scans over quantities read nothing else, the price of a slot
+// follows from its position in the window.
+// The side is a template parameter, so price comparisons and search directions are resolved at compile time
+template <Side S, typename Instrument, typename Layout>
 struct OrderBookSide {
-    PriceLevel levels_[NUM_LEVELS]; // Pre-allocate memory for price levels
-    OrderPool pool_;
-    bool is_bid_; // Bid or ask side, determines which direction to sort for best price
+    static constexpr bool IS_BID = S == Side::Bid; // Determines which direction to sort for best price
+    using Order = typename Layout::Order;
+    using Handle = typename Layout::Handle;
+    using Level = PriceLevel<Layout>;
+    static constexpr Handle NIL = Layout::NIL;
+    // Largest price and quantity the layout can store in an order
+    static constexpr size_t MAX_PRICE = std::numeric_limits<decltype(Order::price_)>::max();
+    static constexpr size_t MAX_QUANTITY = std::numeric_limits<decltype(Order::quantity_)>::max();
+
+    // References to the fields of one level, whether it lives in the dense arrays or in the overflow
+    struct LevelRef {
+        size_t& total_quantity_;
+        Handle& first_;
+        Handle& last_;
+        uint32_t& order_count_;
+    };
+
+    Instrument instrument_;
+    std::vector<size_t> quantities_; // Total liquidity per slot
+    std::vector<Handle> heads_; // First order that came in at each slot
+    std::vector<Handle> tails_; // Last order that came in at each slot
+    std::vector<uint32_t> counts_; // Orders resting at each slot
+    LevelBitmap occupied_; // Non-empty price levels, only maintained for LevelSearch::Bitmap
+    LevelSearch level_search_;
+    const LevelScanKernels* scan_; // Used for LevelSearch::Scan
+    std::map<size_t, Level> overflow_; // Non-empty levels outside the window, keyed by tick
+    std::vector<size_t> dirty_; // Ticks whose total changed during the current message, each listed once
+    L3Writer* l3_ = nullptr; // Order-by-order feed, off when null
+    OrderPool<Layout>& pool_; // Shared with the other side, owned by the OrderBook
+    OrderIndex<Layout>& index_; // Shared with the other side, owned by the OrderBook
+    size_t base_tick_; // Tick of the lowest price in the window
     size_t best_price_index_; // Index directly to the best available price for the given side (bid/ask)
 
-    OrderBookSide(bool is_bid) : is_bid_(is_bid) {
-        best_price_index_ = NUM_LEVELS; // NUM_LEVELS means no available best price (empty order book)
-        for (size_t i = 0; i < NUM_LEVELS; ++i) {
-            levels_[i].price_ = PRICE_MIN + i * TICK_SIZE;
-            levels_[i].total_quantity_ = 0;
-            levels_[i].first_ = nullptr;
-            levels_[i].last_ = nullptr;
+    OrderBookSide(
+        OrderPool<Layout>& pool,
+        OrderIndex<Layout>& index,
+        const Instrument& instrument,
+        LevelSearch level_search
+    )
+        : instrument_(instrument),
+          quantities_(instrument.num_levels(), 0),
+          heads_(instrument.num_levels(), NIL),
+          tails_(instrument.num_levels(), NIL),
+          counts_(instrument.num_levels(), 0),
+          occupied_(instrument.num_levels()),
+          level_search_(level_search),
+          scan_(&level_scan_kernels()),
+          pool_(pool),
+          index_(index),
+          base_tick_(instrument.price_min() / instrument.tick_size()) {
+        dirty_.reserve(64);
+        best_price_index_ = num_levels(); // num_levels() means no available best price (empty order book)
+    }
+
+    inline size_t num_levels() const noexcept { return instrument_.num_levels(); }
+    inline size_t mask() const noexcept { return num_levels() - 1; }
+
+    inline size_t price_to_tick(size_t price) const noexcept {
+        return price / instrument_.tick_size();
+    }
+
+    inline bool in_window(size_t tick) const noexcept {
+        return tick - base_tick_ < num_levels(); // Wraps for ticks below the window
+    }
+
+    // Position of a slot counted from the bottom of the window
+    inline size_t logical(size_t idx) const noexcept {
+        return (idx - base_tick_) & mask();
+    }
+
+    inline size_t index_to_price(size_t idx) const noexcept {
+        return (base_tick_ + logical(idx)) * instrument_.tick_size();
+    }
+
+    inline bool is_better(size_t price, size_t than) const noexcept {
+        if constexpr (IS_BID) {
+            return price > than;
+        } else {
+            return price < than;
         }
     }
 
-    inline size_t price_to_index(size_t price) const noexcept {
-        assert(price >= PRICE_MIN && price <= PRICE_MAX);
-        return static_cast<size_t>((price - PRICE_MIN) / TICK_SIZE);
+    inline LevelRef dense_level(size_t idx) noexcept {
+        return LevelRef{quantities_[idx], heads_[idx], tails_[idx], counts_[idx]};
+    }
+
+    static inline LevelRef overflow_level(Level& level) noexcept {
+        return LevelRef{level.total_quantity_, level.first_, level.last_, level.order_count_};
     }
 
+    // Within one message a side touches either a run of levels in matching order, or one level to remove from and
+    // one to add to, so a tick that is touched again is always the last one recorded
+    inline void mark_dirty(size_t tick) noexcept {
+        if (dirty_.empty() || dirty_.back() != tick) dirty_.push_back(tick);
+    }
 
-    Order* add_order(size_t price, size_t quantity, size_t id) noexcept {
-        size_t idx = price_to_index(price);
-        assert(idx < NUM_LEVELS);
+    // Current total of any level, 0 if it is empty
+    size_t level_quantity(size_t tick) const noexcept {
+        if (in_window(tick)) return quantities_[tick & mask()];
+        auto it = overflow_.find(tick);
+        return it != overflow_.end() ? it->second.total_quantity_ : 0;
+    }
 
-        Order* order = pool_.allocate();
-        if (!order) return nullptr; // Cannot place order because no memory is available
+    inline size_t best_price() const noexcept {
+        return best_price_index_ == num_levels() ? 0 : index_to_price(best_price_index_);
+    }
 
-        order->order_id_ = id;
-        order->price_ = price;
-        order->quantity_ = quantity;
-        order->next_ = nullptr;
+    inline size_t best_quantity() const noexcept {
+        return best_price_index_ == num_levels() ? 0 : quantities_[best_price_index_];
+    }
 
-        PriceLevel& level = levels_[idx];
-        if (!level.first_) {
-            level.first_ = order;
-            level.last_ = order;
+    // Pull in the slot an order at this price would rest on, overflow levels are left alone
+    void prefetch_level(size_t price) const noexcept {
+        size_t tick = price_to_tick(price);
+        if (!in_window(tick)) return;
+        size_t idx = tick & mask();
+        __builtin_prefetch(&quantities_[idx], 1);
+        __builtin_prefetch(&heads_[idx], 1);
+        __builtin_prefetch(&tails_[idx], 1);
+        __builtin_prefetch(&counts_[idx], 1);
+    }
+
+    // Pull in the best level and the order at the front of its queue, where an incoming order starts matching
+    void prefetch_best() const noexcept {
+        if (best_price_index_ == num_levels()) return;
+        __builtin_prefetch(&quantities_[best_price_index_], 1);
+        Handle head = heads_[best_price_index_];
+        if (head != NIL) __builtin_prefetch(&pool_.at(head), 1);
+    }
+
+    LevelRef level_for(size_t price) noexcept {
+        size_t tick = price_to_tick(price);
+        if (in_window(tick)) return dense_level(tick & mask());
+        auto it = overflow_.find(tick);
+        assert(it != overflow_.end());
+        return overflow_level(it->second);
+    }
+
+    Handle add_order(size_t price, size_t quantity, size_t id) noexcept {
+        if (price > MAX_PRICE || quantity > MAX_QUANTITY) return NIL; // Does not fit the storage layout
+
+        // Allocate first, a rejected order must leave the window where it was
+        Handle handle = pool_.allocate();
+        if (handle == NIL) return NIL; // Cannot place order because no memory is available
+
+        size_t tick = price_to_tick(price);
+        if (!in_window(tick)) {
+            // A new best price pulls the window along, anything worse rests in the overflow
+            if (best_price_index_ == num_levels() || is_better(price, index_to_price(best_price_index_))) {
+                recenter(tick);
+            }
+        }
+
+        Order& order = pool_.at(handle);
+        pool_.set_id(handle, id);
+        order.price_ = static_cast<decltype(order.price_)>(price);
+        order.quantity_ = static_cast<decltype(order.quantity_)>(quantity);
+        order.next_ = NIL;
+
+        bool dense = in_window(tick);
+        LevelRef level = dense
+            ? dense_level(tick & mask())
+            : overflow_level(overflow_.try_emplace(tick, Level{tick * instrument_.tick_size(), 0, NIL, NIL, 0}).first->second);
+
+        if (level.first_ == NIL) {
+            order.prev_ = NIL;
+            level.first_ = handle;
+            level.last_ = handle;
         } else {
-            level.last_->next_ = order;
-            level.last_ = order;
+            order.prev_ = level.last_;
+            pool_.at(level.last_).next_ = handle;
+            level.last_ = handle;
         }
         level.total_quantity_ += quantity;
-        is_bid_ ? update_best_bid_after_order(idx) : update_best_ask_after_order(idx); // Update the index for the best price level
-        return order;
-    }
-
-    void update_best_bid_after_order(size_t price_idx) {
-        if ((best_price_index_ == NUM_LEVELS) || (price_idx > best_price_index_)) {
-            best_price_index_ = price_idx;
-            return;
+        ++level.order_count_;
+        index_.insert(id, handle, IS_BID);
+        mark_dirty(tick);
+        if (l3_) l3_->add(id, IS_BID, price, quantity);
+        if (dense) {
+            size_t idx = tick & mask();
+            mark_occupied(idx);
+            update_best_after_order(idx); // Update the index for the best price level
         }
+        return handle;
     }
 
-    void update_best_ask_after_order(size_t price_idx) {
-        if ((best_price_index_ == NUM_LEVELS) || (price_idx < best_price_index_)) {
-            best_price_index_ = price_idx;
-            return;
+    // Unlink a resting order from its price level and return it to the pool, O(1) inside the window
+    void remove_order(Handle handle) noexcept {
+        Order& order = pool_.at(handle);
+        size_t tick = price_to_tick(order.price_);
+        mark_dirty(tick);
+        if (l3_) l3_->remove(pool_.id(handle));
+        bool dense = in_window(tick);
+        auto it = dense ? overflow_.end() : overflow_.find(tick);
+        LevelRef level = dense ? dense_level(tick & mask()) : overflow_level(it->second);
+
+        if (order.prev_ != NIL) {
+            pool_.at(order.prev_).next_ = order.next_;
+        } else {
+            level.first_ = order.next_;
         }
-    }
+        if (order.next_ != NIL) {
+            pool_.at(order.next_).prev_ = order.prev_;
+        } else {
+            level.last_ = order.prev_;
+        }
+        level.total_quantity_ -= order.quantity_;
+        --level.order_count_;
+        pool_.deallocate(handle);
 
-    void update_best_bid_after_empty(size_t old_idx) noexcept {
-        for (size_t i = old_idx; i-- > 0; ) {
-            if (levels_[i].total_quantity_ > 0) {
-                best_price_index_ = i;
+        if (level.first_ == NIL) {
+            if (!dense) {
+                overflow_.erase(it);
                 return;
             }
+            size_t idx = tick & mask();
+            mark_empty(idx);
+            if (idx == best_price_index_) {
+                update_best_after_empty(idx);
+            }
         }
-        best_price_index_ = NUM_LEVELS;
     }
 
-    void update_best_ask_after_empty(size_t old_idx) noexcept {
-        for (size_t i = old_idx + 1; i < NUM_LEVELS; ++i) {
-            if (levels_[i].total_quantity_ > 0) {
-                best_price_index_ = i;
-                return;
+    // Shrink a resting order without touching its queue position
+    void reduce_order(Handle handle, size_t new_quantity) noexcept {
+        Order& order = pool_.at(handle);
+        assert(new_quantity > 0 && new_quantity <= order.quantity_);
+        mark_dirty(price_to_tick(order.price_));
+        if (l3_) l3_->cancel(pool_.id(handle), order.quantity_ - new_quantity);
+        level_for(order.price_).total_quantity_ -= order.quantity_ - new_quantity;
+        order.quantity_ = static_cast<decltype(order.quantity_)>(new_quantity);
+    }
+
+    // Move the window so that anchor_tick sits in its middle. Only the slots whose tick changes are touched:
+    // levels leaving the window spill into overflow_, overflow levels entering it are moved back in.
+    void recenter(size_t anchor_tick) noexcept {
+        size_t half = num_levels() / 2;
+        size_t new_base = anchor_tick > half ? anchor_tick - half : 0;
+        if (new_base == base_tick_) return;
+
+        size_t old_base = base_tick_;
+        bool up = new_base > old_base;
+        size_t moved = std::min(up ? new_base - old_base : old_base - new_base, num_levels());
+        size_t leave_from = up ? old_base : old_base + num_levels() - moved;
+        size_t enter_from = up ? new_base + num_levels() - moved : new_base;
+
+        bool had_best = best_price_index_ != num_levels();
+        size_t best_tick = had_best ? price_to_tick(index_to_price(best_price_index_)) : 0;
+
+        for (size_t tick = leave_from; tick < leave_from + moved; ++tick) {
+            size_t idx = tick & mask();
+            if (heads_[idx] != NIL) {
+                overflow_.insert_or_assign(
+                    tick, Level{tick * instrument_.tick_size(), quantities_[idx], heads_[idx], tails_[idx], counts_[idx]}
+                );
+                mark_empty(idx);
             }
+            quantities_[idx] = 0;
+            heads_[idx] = NIL;
+            tails_[idx] = NIL;
+            counts_[idx] = 0;
+        }
+
+        base_tick_ = new_base;
+        auto it = overflow_.lower_bound(enter_from);
+        while (it != overflow_.end() && it->first < enter_from + moved) {
+            size_t idx = it->first & mask();
+            quantities_[idx] = it->second.total_quantity_;
+            heads_[idx] = it->second.first_;
+            tails_[idx] = it->second.last_;
+            counts_[idx] = it->second.order_count_;
+            mark_occupied(idx);
+            it = overflow_.erase(it);
         }
-        best_price_index_ = NUM_LEVELS;
+
+        // The best level keeps its slot if it is still inside the window, otherwise it was spilled
+        if (had_best && !in_window(best_tick)) best_price_index_ = num_levels();
     }
 
-    size_t match_buy(
-        size_t incoming_price, size_t incoming_quantity, size_t incoming_id, std::vector<Trade>& trades
-    ) noexcept {
-        while (incoming_quantity > 0) {
-            if (best_price_index_ == NUM_LEVELS) {
-                break; // best_price_index_ == NUM_LEVELS means empty order book
-            }
-            PriceLevel* level = &levels_[best_price_index_];            
+    void update_best_after_order(size_t price_idx) noexcept {
+        if ((best_price_index_ == num_levels()) || is_better(logical(price_idx), logical(best_price_index_))) {
+            best_price_index_ = price_idx;
+        }
+    }
 
-            if (!(level->price_ <= incoming_price)){
-                break;
-            }
+    inline void mark_occupied(size_t idx) noexcept {
+        if (level_search_ == LevelSearch::Bitmap) occupied_.set(idx);
+    }
 
-            // match orders in FIFO order
-            while (incoming_quantity > 0 && level->first_) {
-                Order* maker = level->first_;
-                size_t trade_quantity = std::min(maker->quantity_, incoming_quantity);
+    inline void mark_empty(size_t idx) noexcept {
+        if (level_search_ == LevelSearch::Bitmap) occupied_.clear(idx);
+    }
 
-                trades.push_back(Trade{incoming_id, maker->order_id_, maker->price_, trade_quantity});
+    // First non-empty slot in [from, to), num_levels() if there is none
+    inline size_t next_occupied(size_t from, size_t to) const noexcept {
+        size_t found = level_search_ == LevelSearch::Bitmap
+            ? occupied_.next(from)
+            : scan_->forward_(quantities_.data(), from, to);
+        return found < to ? found : num_levels();
+    }
 
-                maker->quantity_ -= trade_quantity;
-                incoming_quantity -= trade_quantity;
-                level->total_quantity_ -= trade_quantity;
+    // Last non-empty slot in [from, to), num_levels() if there is none
+    inline size_t prev_occupied(size_t from, size_t to) const noexcept {
+        if (level_search_ == LevelSearch::Bitmap) {
+            size_t found = occupied_.prev(to - 1);
+            return found != num_levels() && found >= from ? found : num_levels();
+        }
+        size_t found = scan_->backward_(quantities_.data(), from, to);
+        return found < to ? found : num_levels();
+    }
 
-                if (maker->quantity_ == 0) {
-                    // remove maker from level
-                    level->first_ = maker->next_;
-                    if (!level->first_) {
-                        level->last_ = nullptr;
-                        update_best_ask_after_empty(best_price_index_); // Price level has been depleted, update best price level
-                    }
-                    pool_.deallocate(maker);
-                }
+    // Occupied slot with the lowest window position >= pos, num_levels() if there is none.
+    // The window runs from base_tick_'s slot to the end of the arrays and wraps around to the start
+    size_t first_occupied_from(size_t pos) const noexcept {
+        if (pos >= num_levels()) return num_levels();
+        size_t base_idx = base_tick_ & mask();
+        size_t idx = (base_tick_ + pos) & mask();
+        if (idx < base_idx) return next_occupied(idx, base_idx);
+        size_t found = next_occupied(idx, num_levels());
+        return found != num_levels() ? found : next_occupied(0, base_idx);
+    }
+
+    // Occupied slot with the highest window position <= pos, num_levels() if there is none
+    size_t last_occupied_upto(size_t pos) const noexcept {
+        size_t base_idx = base_tick_ & mask();
+        size_t idx = (base_tick_ + pos) & mask();
+        if (idx >= base_idx) return prev_occupied(base_idx, idx + 1);
+        size_t found = prev_occupied(0, idx + 1);
+        return found != num_levels() ? found : prev_occupied(base_idx, num_levels());
+    }
+
+    void update_best_after_empty(size_t old_idx) noexcept {
+        if constexpr (IS_BID) {
+            size_t pos = logical(old_idx);
+            best_price_index_ = pos == 0 ? num_levels() : last_occupied_upto(pos - 1);
+            if (best_price_index_ == num_levels() && !overflow_.empty()) {
+                recenter(overflow_.rbegin()->first); // Everything in the overflow is below the window
+                best_price_index_ = last_occupied_upto(mask());
+            }
+        } else {
+            best_price_index_ = first_occupied_from(logical(old_idx) + 1);
+            if (best_price_index_ == num_levels() && !overflow_.empty()) {
+                recenter(overflow_.begin()->first); // Everything in the overflow is above the window
+                best_price_index_ = first_occupied_from(0);
             }
         }
+    }
 
-        return incoming_quantity;
+    // Copies up to n levels, best first, into the caller's buffers and returns how many were written. Empty levels
+    // are skipped with the occupancy search, the overflow is only reached once the window runs out
+    size_t depth(size_t n, size_t* out_prices, size_t* out_qtys) const noexcept {
+        size_t count = 0;
+        if (best_price_index_ != num_levels()) {
+            size_t pos = logical(best_price_index_);
+            while (count < n) {
+                size_t idx = (base_tick_ + pos) & mask();
+                if (pos >= num_levels() || quantities_[idx] == 0) { // Neighbouring levels are usually occupied
+                    idx = IS_BID ? last_occupied_upto(pos) : first_occupied_from(pos);
+                }
+                if (idx == num_levels()) break;
+                out_prices[count] = index_to_price(idx);
+                out_qtys[count] = quantities_[idx];
+                ++count;
+                pos = logical(idx);
+                if constexpr (IS_BID) {
+                    if (pos == 0) break;
+                    --pos;
+                } else {
+                    ++pos;
+                }
+            }
+        }
+        // The overflow only holds levels worse than the whole window, below it for bids and above it for asks
+        auto copy = [&](const Level& level) {
+            out_prices[count] = level.price_;
+            out_qtys[count] = level.total_quantity_;
+            ++count;
+        };
+        if constexpr (IS_BID) {
+            for (auto it = overflow_.rbegin(); it != overflow_.rend() && count < n; ++it) copy(it->second);
+        } else {
+            for (auto it = overflow_.begin(); it != overflow_.end() && count < n; ++it) copy(it->second);
+        }
+        return count;
     }
 
-    size_t match_sell(
-        size_t incoming_price, size_t incoming_quantity, size_t incoming_id, std::vector<Trade>& trades
-    ) noexcept {
+    // Match an incoming order from the opposite side against this side, returns the quantity left over
+    template <typename Sink>
+    size_t match(size_t incoming_price, size_t incoming_quantity, size_t incoming_id, Sink& sink) noexcept {
         while (incoming_quantity > 0) {
-            if (best_price_index_ == NUM_LEVELS) {
-                break;
+            if (best_price_index_ == num_levels()) {
+                break; // best_price_index_ == num_levels() means empty order book
             }
-            
-            PriceLevel* level = &levels_[best_price_index_];
-    
-            if (!(level->price_ >= incoming_price)){
-                break;
+            size_t idx = best_price_index_;
+
+            if (is_better(incoming_price, index_to_price(idx))) {
+                break; // The incoming order does not cross the best level
             }
 
-            while (incoming_quantity > 0 && level->first_) {
-                Order* maker = level->first_;
-                size_t trade_quantity = std::min(maker->quantity_, incoming_quantity);
+            mark_dirty(base_tick_ + logical(idx));
+
+            // match orders in FIFO order
+            while (incoming_quantity > 0 && heads_[idx] != NIL) {
+                Handle maker_handle = heads_[idx];
+                Order& maker = pool_.at(maker_handle);
+                size_t maker_id = pool_.id(maker_handle);
+                size_t trade_quantity = std::min<size_t>(maker.quantity_, incoming_quantity);
 
-                trades.push_back(Trade{incoming_id, maker->order_id_, maker->price_, trade_quantity});
+                deliver(sink, Trade{incoming_id, maker_id, maker.price_, trade_quantity});
+                if (l3_) l3_->execute(maker_id, trade_quantity, incoming_id);
 
-                maker->quantity_ -= trade_quantity;
+                maker.quantity_ -= static_cast<decltype(maker.quantity_)>(trade_quantity);
                 incoming_quantity -= trade_quantity;
-                level->total_quantity_ -= trade_quantity;
+                quantities_[idx] -= trade_quantity;
+
+                deliver(sink, ExecutionReport{
+                    incoming_id, maker_id, maker.price_, trade_quantity, incoming_quantity,
+                    incoming_quantity ? ExecType::PartialFill : ExecType::Fill, RejectReason::None, !IS_BID
+                });
+                deliver(sink, ExecutionReport{
+                    maker_id, incoming_id, maker.price_, trade_quantity, maker.quantity_,
+                    maker.quantity_ ? ExecType::PartialFill : ExecType::Fill, RejectReason::None, IS_BID
+                });
 
-                if (maker->quantity_ == 0) {
-                    level->first_ = maker->next_;
-                    if (!level->first_) {
-                        level->last_ = nullptr;
-                        update_best_bid_after_empty(best_price_index_);
+                if (maker.quantity_ == 0) {
+                    // remove maker from level
+                    heads_[idx] = maker.next_;
+                    --counts_[idx];
+                    index_.erase(maker_id);
+                    pool_.deallocate(maker_handle);
+                    if (heads_[idx] != NIL) {
+                        pool_.at(heads_[idx]).prev_ = NIL;
+                    } else {
+                        tails_[idx] = NIL;
+                        mark_empty(idx);
+                        update_best_after_empty(idx); // Price level has been depleted, update best price level
+                        break; // The window may have been recentered, re-read the best level
                     }
-                    pool_.deallocate(maker);
                 }
             }
         }
@@ -219,54 +1084,309 @@ struct OrderBookSide {
         return incoming_quantity;
     }
 
+    void print_level(size_t price, Handle first) const {
+        std::cout << "Price " << price << " -> ";
+        Handle cur = first;
+        while (cur != NIL) {
+            std::cout << "[id=" << pool_.id(cur) 
+                      << ", qty=" << pool_.at(cur).quantity_ << "] ";
+            cur = pool_.at(cur).next_;
+        }
+        std::cout << "\n";
+    }
+
     void print_side(const char* name) const {
         std::cout << "=== " << name << " ===\n";
-        for (size_t i = 0; i < NUM_LEVELS; ++i) {
-            const PriceLevel& level = levels_[i];
-            if (level.total_quantity_ == 0) continue;
-
-            std::cout << "Price " << level.price_ << " -> ";
-            Order* cur = level.first_;
-            while (cur) {
-                std::cout << "[id=" << cur->order_id_ 
-                          << ", qty=" << cur->quantity_ << "] ";
-                cur = cur->next_;
-            }
-            std::cout << "\n";
+        auto it = overflow_.begin();
+        for (; it != overflow_.end() && it->first < base_tick_; ++it) {
+            print_level(it->second.price_, it->second.first_);
+        }
+        for (size_t tick = base_tick_; tick < base_tick_ + num_levels(); ++tick) {
+            size_t idx = tick & mask();
+            if (quantities_[idx] == 0) continue;
+            print_level(tick * instrument_.tick_size(), heads_[idx]);
+        }
+        for (; it != overflow_.end(); ++it) {
+            print_level(it->second.price_, it->second.first_);
         }
         std::cout << "\n";
     }
 };
 
+template <typename Instrument = DefaultInstrument, typename Layout = PointerLayout>
 struct OrderBook {
-    OrderBookSide bids;
-    OrderBookSide asks;
+    using BidSide = OrderBookSide<Side::Bid, Instrument, Layout>;
+    using AskSide = OrderBookSide<Side::Ask, Instrument, Layout>;
+    using Index = OrderIndex<Layout>;
+    using Handle = typename Layout::Handle;
 
-    OrderBook() : bids(true), asks(false) {}
+    // One pool and one index for both sides, so neither side can run out while the other has room.
+    // Both must be constructed before the sides that reference them
+    OrderPool<Layout> pool_;
+    Index index_;
+    BidSide bids;
+    AskSide asks;
+    std::vector<LevelUpdate> updates_; // Storage behind the BookDelta of the last message
+    Bbo published_bbo_{}; // BBO as of the last BookDelta
+    PublishedBbo top_of_book_; // For readers on other threads, updated at the end of every message
 
-    void submit_order(
+    explicit OrderBook(
+        const Instrument& instrument = Instrument{},
+        const PoolOptions& pool_options = PoolOptions{},
+        LevelSearch level_search = LevelSearch::Bitmap
+    )
+        : pool_(instrument.max_orders(), pool_options),
+          index_(std::min(instrument.max_orders(), pool_options.chunk_orders_)),
+          bids(pool_, index_, instrument, level_search),
+          asks(pool_, index_, instrument, level_search) {}
+
+    OrderBook(const OrderBook&) = delete; // The sides hold references to pool_ and index_
+    OrderBook& operator=(const OrderBook&) = delete;
+
+    // Fills and execution reports go to sink as they happen, followed by one BookDelta for the whole message. Returns
+    // false if the order was rejected, or if the residual quantity could not rest because the order pool is exhausted
+    // or it does not fit the storage layout
+    template <typename Sink>
+    bool submit_order(
         size_t price, 
         size_t quantity, 
         size_t id, 
         bool is_bid,
-        std::vector<Trade>& trades
+        Sink&& sink
     ) {
+        static_assert(
+            std::is_invocable_v<Sink&, const Trade&> || std::is_invocable_v<Sink&, const ExecutionReport&>
+                || WANTS_DELTAS<Sink>,
+            "A sink takes a const Trade&, a const ExecutionReport&, a const BookDelta& or several of them"
+        );
+        bool result = process_submit(price, quantity, id, is_bid, sink);
+        end_message(sink);
+        return result;
+    }
+
+    // Vector version, trades only holds the fills of this order
+    bool submit_order(size_t price, size_t quantity, size_t id, bool is_bid, std::vector<Trade>& trades) {
         trades.clear();
-        if (quantity == 0) return;
-        size_t remaining = quantity;
+        return submit_order(price, quantity, id, is_bid, VectorTradeSink{trades});
+    }
 
-        if (is_bid) {
-            size_t remaining = asks.match_buy(price, quantity, id, trades);
-            if (remaining > 0) {
-                bids.add_order(price, remaining, id);
-            }
+    // Returns false if no resting order with this ID exists
+    template <typename Listener>
+    bool cancel_order(size_t id, Listener&& listener) {
+        bool result = process_cancel(id, listener);
+        end_message(listener);
+        return result;
+    }
+
+    bool cancel_order(size_t id) noexcept {
+        return cancel_order(id, [](const ExecutionReport&) noexcept {});
+    }
+
+    // A size decrease at the same price keeps queue priority and is acked, the same price and size changes nothing
+    // but is acked too, a zero size is a cancel, anything else is a cancel and re-entry that may match and reports
+    // like a new order. Returns false if no resting order with this ID exists, or if the re-entered order could not rest
+    template <typename Sink>
+    bool modify_order(size_t id, size_t new_price, size_t new_quantity, Sink&& sink) {
+        bool result = process_modify(id, new_price, new_quantity, sink);
+        end_message(sink);
+        return result;
+    }
+
+    bool modify_order(size_t id, size_t new_price, size_t new_quantity, std::vector<Trade>& trades) {
+        trades.clear();
+        return modify_order(id, new_price, new_quantity, VectorTradeSink{trades});
+    }
+
+    // Goes straight to the processing steps rather than the public overloads, so a batch keeps every fill. A vector
+    // is not a batch sink, wrap it in a VectorTradeSink
+    template <typename Sink>
+    bool execute(const OrderCmd& command, Sink&& sink) {
+        static_assert(
+            std::is_invocable_v<Sink&, const Trade&> || std::is_invocable_v<Sink&, const ExecutionReport&>
+                || WANTS_DELTAS<Sink>,
+            "A sink takes a const Trade&, a const ExecutionReport&, a const BookDelta& or several of them"
+        );
+        bool result = false;
+        switch (command.type) {
+            case CommandType::New:
+                result = process_submit(command.price, command.quantity, command.id, command.is_bid, sink);
+                break;
+            case CommandType::Cancel:
+                result = process_cancel(command.id, sink);
+                break;
+            case CommandType::Modify:
+                result = process_modify(command.id, command.price, command.quantity, sink);
+                break;
+        }
+        end_message(sink);
+        return result;
+    }
+
+    static constexpr size_t PREFETCH_DISTANCE = 8; // Commands between the first prefetch and the command that uses it
+
+    // Runs a batch of commands in order, prefetching for later commands while the current one matches. Returns how
+    // many of them succeeded
+    template <typename Sink>
+    size_t submit_orders(const OrderCmd* commands, size_t count, Sink&& sink) {
+        size_t succeeded = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (i + PREFETCH_DISTANCE < count) prefetch(commands[i + PREFETCH_DISTANCE]);
+            if (i + PREFETCH_DISTANCE / 2 < count) prefetch_resting(commands[i + PREFETCH_DISTANCE / 2]);
+            succeeded += execute(commands[i], sink);
+        }
+        return succeeded;
+    }
+
+    // The index slot for any command, and for new orders the level they would rest on and the opposite best level
+    void prefetch(const OrderCmd& command) const noexcept {
+        index_.prefetch(command.id);
+        if (command.type != CommandType::New) return;
+        if (command.is_bid) {
+            bids.prefetch_level(command.price);
+            asks.prefetch_best();
         } else {
-            size_t remaining = bids.match_sell(price, quantity, id, trades);
-            if (remaining > 0) {
-                asks.add_order(price, remaining, id);
+            asks.prefetch_level(command.price);
+            bids.prefetch_best();
+        }
+    }
+
+    // Second stage for cancels and modifies, once their index slot has had time to arrive: the resting order itself
+    void prefetch_resting(const OrderCmd& command) noexcept {
+        if (command.type == CommandType::New) return;
+        typename Index::Entry* entry = index_.find(command.id);
+        if (entry) __builtin_prefetch(&pool_.at(entry->order_), 1);
+    }
+
+    // Start or stop (nullptr) the order-by-order feed, the writer must outlive the book or be detached first
+    void attach_l3(L3Writer* writer) noexcept {
+        bids.l3_ = writer;
+        asks.l3_ = writer;
+    }
+
+    Bbo bbo() const noexcept {
+        return Bbo{bids.best_price(), bids.best_quantity(), asks.best_price(), asks.best_quantity()};
+    }
+
+    template <typename Sink>
+    bool process_submit(size_t price, size_t quantity, size_t id, bool is_bid, Sink& sink) {
+        constexpr size_t NO_ORDER = ExecutionReport::NO_ORDER;
+        if (quantity == 0) {
+            deliver(sink, ExecutionReport{
+                id, NO_ORDER, price, 0, 0, ExecType::Reject, RejectReason::ZeroQuantity, is_bid
+            });
+            return false;
+        }
+        if (price % bids.instrument_.tick_size() != 0) { // Would otherwise be floored onto a level below its price
+            deliver(sink, ExecutionReport{id, NO_ORDER, price, quantity, 0, ExecType::Reject, RejectReason::OffTick, is_bid});
+            return false;
+        }
+        if (index_.find(id)) { // An order with this ID is already resting
+            deliver(sink, ExecutionReport{
+                id, NO_ORDER, price, quantity, 0, ExecType::Reject, RejectReason::DuplicateId, is_bid
+            });
+            return false;
+        }
+        deliver(sink, ExecutionReport{id, NO_ORDER, price, quantity, quantity, ExecType::Ack, RejectReason::None, is_bid});
+
+        size_t remaining = is_bid ? asks.match(price, quantity, id, sink) : bids.match(price, quantity, id, sink);
+        if (remaining == 0) return true;
+
+        Handle rested = is_bid ? bids.add_order(price, remaining, id) : asks.add_order(price, remaining, id);
+        if (rested == Layout::NIL) {
+            bool fits = price <= BidSide::MAX_PRICE && remaining <= BidSide::MAX_QUANTITY;
+            deliver(sink, ExecutionReport{
+                id, NO_ORDER, price, remaining, 0, ExecType::Reject,
+                fits ? RejectReason::BookFull : RejectReason::DoesNotFit, is_bid
+            });
+            return false;
+        }
+        deliver(sink, ExecutionReport{id, NO_ORDER, price, remaining, remaining, ExecType::Rest, RejectReason::None, is_bid});
+        return true;
+    }
+
+    template <typename Listener>
+    bool process_cancel(size_t id, Listener& listener) {
+        typename Index::Entry* entry = index_.find(id);
+        if (!entry) {
+            deliver(listener, ExecutionReport{
+                id, ExecutionReport::NO_ORDER, 0, 0, 0, ExecType::Reject, RejectReason::UnknownOrder, false
+            });
+            return false;
+        }
+
+        Handle order = entry->order_;
+        bool is_bid = entry->is_bid_;
+        const typename Layout::Order& resting = pool_.at(order);
+        deliver(listener, ExecutionReport{
+            id, ExecutionReport::NO_ORDER, resting.price_, resting.quantity_, 0, ExecType::Cancel, RejectReason::None, is_bid
+        });
+        index_.erase(entry);
+        is_bid ? bids.remove_order(order) : asks.remove_order(order);
+        return true;
+    }
+
+    template <typename Sink>
+    bool process_modify(size_t id, size_t new_price, size_t new_quantity, Sink& sink) {
+        typename Index::Entry* entry = index_.find(id);
+        if (!entry) {
+            deliver(sink, ExecutionReport{
+                id, ExecutionReport::NO_ORDER, new_price, new_quantity, 0, ExecType::Reject, RejectReason::UnknownOrder, false
+            });
+            return false;
+        }
+        if (new_quantity == 0) return process_cancel(id, sink);
+
+        Handle order = entry->order_;
+        bool is_bid = entry->is_bid_;
+        if (new_price % bids.instrument_.tick_size() != 0) { // The resting order is left as it was
+            deliver(sink, ExecutionReport{
+                id, ExecutionReport::NO_ORDER, new_price, new_quantity, 0, ExecType::Reject, RejectReason::OffTick, is_bid
+            });
+            return false;
+        }
+        const typename Layout::Order& resting = pool_.at(order);
+
+        if (new_price == resting.price_ && new_quantity <= resting.quantity_) {
+            // The same size changes nothing in the book but is still acked
+            if (new_quantity < resting.quantity_) {
+                is_bid ? bids.reduce_order(order, new_quantity) : asks.reduce_order(order, new_quantity);
+            }
+            deliver(sink, ExecutionReport{
+                id, ExecutionReport::NO_ORDER, new_price, new_quantity, new_quantity, ExecType::Ack, RejectReason::None, is_bid
+            });
+            return true;
+        }
+
+        if (bids.l3_) bids.l3_->begin_replace(id);
+        index_.erase(entry);
+        is_bid ? bids.remove_order(order) : asks.remove_order(order);
+        bool rested = process_submit(new_price, new_quantity, id, is_bid, sink);
+        if (bids.l3_) bids.l3_->end_replace();
+        return rested;
+    }
+
+    // Publishes the BBO for other threads, and turns the levels the message touched into one BookDelta for sinks that
+    // take it. No delta is sent if neither a level nor the BBO changed
+    template <typename Sink>
+    void end_message(Sink& sink) {
+        Bbo current = bbo();
+        top_of_book_.publish(current);
+        if constexpr (WANTS_DELTAS<Sink>) {
+            updates_.clear();
+            for (size_t tick : bids.dirty_) {
+                updates_.push_back(LevelUpdate{tick * bids.instrument_.tick_size(), bids.level_quantity(tick), true});
+            }
+            for (size_t tick : asks.dirty_) {
+                updates_.push_back(LevelUpdate{tick * asks.instrument_.tick_size(), asks.level_quantity(tick), false});
+            }
+            bool bbo_changed = current != published_bbo_;
+            if (!updates_.empty() || bbo_changed) {
+                published_bbo_ = current;
+                sink(BookDelta{updates_.data(), updates_.size(), current, bbo_changed});
             }
         }
-        return;
+        bids.dirty_.clear();
+        asks.dirty_.clear();
     }
 
     void print_book() const {
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "checksum.hpp"
+#include "journal.hpp"
+#include "orderbook.hpp"
+#include "snapshot.hpp"
+
+// Folds every trade into a running CRC-32C, in the order the book emits them. Two runs over the same commands give
+// the same value only if every fill matched the same orders at the same prices and sizes
+struct ChecksumTradeSink {
+    uint32_t crc_ = 0;
+    size_t trades_ = 0;
+
+    void operator()(const Trade& trade) noexcept {
+        crc_ = crc32c(crc_, &trade, sizeof(trade));
+        ++trades_;
+    }
+};
+
+// CRC-32C over the book's snapshot image body: every resting order with its level, side and queue position
+template <typename Book>
+uint32_t book_checksum(const Book& book) {
+    std::vector<char> image(snapshot_size(book));
+    write_snapshot(book, image.data());
+    SnapshotHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    return header.checksum;
+}
+
+struct ReplayResult {
+    size_t commands = 0;
+    size_t trades = 0;
+    uint64_t next_sequence = 0; // First sequence not replayed, where live appends would continue
+    uint32_t trade_checksum = 0;
+    uint32_t book_checksum = 0;
+    double seconds = 0; // Replay only, the book checksum is not included
+
+    double orders_per_second() const noexcept { return seconds > 0 ? commands / seconds : 0; }
+};
+
+// Streams the journal from sequence on through the book, decoding a batch of records at a time and running it with
+// submit_orders so the prefetching covers the replay too. Stops at the end of the valid records. To recover after a
+// failover, restore the latest snapshot and pass the sequence it was taken at
+template <typename Book>
+ReplayResult replay_journal(Book& book, const JournalReader& journal, uint64_t sequence, size_t batch = 256) {
+    std::vector<OrderCmd> commands(batch);
+    ChecksumTradeSink sink;
+    ReplayResult result;
+    auto start = std::chrono::steady_clock::now();
+    for (;;) {
+        size_t count = journal.read(sequence, commands.data(), batch);
+        if (count == 0) break;
+        book.submit_orders(commands.data(), count, sink);
+        sequence += count;
+        result.commands += count;
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.trades = sink.trades_;
+    result.next_sequence = sequence;
+    result.trade_checksum = sink.crc_;
+    result.book_checksum = book_checksum(book);
+    return result;
+}
+
+template <typename Book>
+ReplayResult replay_journal(Book& book, const JournalReader& journal) {
+    return replay_journal(book, journal, journal.first_sequence_);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "book_manager.hpp"
+#include "engine.hpp"
+
+// Several engine threads over one BookManager. Gateways push into a single MPSC ring, a router thread sends every
+// command to the shard that owns its symbol, and each shard is a MatchingEngine with its own inbound and outbound
+// rings that only ever touches the books routed to it. Symbols start out spread by a hash of their ID and can be
+// moved to another shard while running, see move_symbol()
+template <typename Layout = PointerLayout, size_t RING_SIZE = size_t{1} << 16>
+struct ShardedRuntime {
+    using Manager = BookManager<Layout>;
+    using Shard = MatchingEngine<Manager, SpscRing<OrderCmd, RING_SIZE>, RING_SIZE>;
+    static constexpr size_t BATCH = 256; // Commands routed between checks of the stop flag and pending moves
+
+    struct Move {
+        uint32_t dense_id;
+        uint32_t shard;
+    };
+
+    Manager& manager_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    MpscRing<OrderCmd, RING_SIZE> inbound_;
+    std::vector<uint32_t> shard_of_; // Dense ID -> shard, router thread only once started
+    std::vector<size_t> routed_; // Commands pushed to each shard, router thread only
+    std::mutex moves_mutex_;
+    std::vector<Move> moves_;
+    std::atomic<bool> moves_pending_{false};
+    std::atomic<bool> running_{false};
+    std::thread router_;
+    size_t moved_ = 0; // Symbols handed over so far, router thread only
+    size_t stalls_ = 0; // Spins on a full shard ring, router thread only
+
+    ShardedRuntime(Manager& manager, size_t num_shards)
+        : manager_(manager), routed_(num_shards, 0) {
+        shards_.reserve(num_shards);
+        for (size_t i = 0; i < num_shards; ++i) shards_.push_back(std::make_unique<Shard>(manager));
+        shard_of_.resize(manager.size());
+        for (size_t dense = 0; dense < manager.size(); ++dense) {
+            shard_of_[dense] = static_cast<uint32_t>(hash(manager.symbol_of_[dense]) % num_shards);
+        }
+    }
+
+    ~ShardedRuntime() { stop(); }
+
+    ShardedRuntime(const ShardedRuntime&) = delete;
+    ShardedRuntime& operator=(const ShardedRuntime&) = delete;
+
+    static uint64_t hash(uint32_t symbol) noexcept {
+        uint64_t h = symbol * 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 32);
+    }
+
+    size_t num_shards() const noexcept { return shards_.size(); }
+
+    // The router goes on first_cpu and shard i on first_cpu + 1 + i, nothing is pinned if first_cpu is negative
+    void start(int first_cpu = -1) {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shards_[i]->start(first_cpu < 0 ? -1 : first_cpu + 1 + static_cast<int>(i));
+        }
+        running_.store(true, std::memory_order_relaxed);
+        router_ = std::thread([this] { route(); });
+        pin_thread(router_, first_cpu);
+    }
+
+    // Everything already pushed is still routed and processed
+    void stop() {
+        running_.store(false, std::memory_order_release);
+        if (router_.joinable()) router_.join();
+        for (auto& shard : shards_) shard->stop();
+    }
+
+    // Gateway side, false if the inbound ring is full
+    bool submit(const OrderCmd& command) noexcept { return inbound_.try_push(command); }
+
+    // Publisher side, one publisher per shard or one that goes round all of them
+    bool poll(size_t shard, ExecutionReport& report) noexcept { return shards_[shard]->poll(report); }
+
+    // Hands a symbol to another shard. The router picks this up between batches, waits until the old shard has
+    // processed everything already routed to it and only then sends the symbol's commands to the new one, so the book
+    // is never touched by two threads and its commands stay in order. Unknown symbols are ignored
+    void move_symbol(uint32_t symbol, size_t shard) {
+        uint32_t dense = manager_.dense_id(symbol);
+        if (dense == Manager::NO_BOOK || shard >= shards_.size()) return;
+        std::lock_guard<std::mutex> lock(moves_mutex_);
+        moves_.push_back(Move{dense, static_cast<uint32_t>(shard)});
+        moves_pending_.store(true, std::memory_order_release);
+    }
+
+    void route() noexcept {
+        OrderCmd command;
+        size_t spins = 0;
+        for (;;) {
+            bool stopping = !running_.load(std::memory_order_acquire);
+            if (moves_pending_.load(std::memory_order_acquire)) apply_moves();
+            size_t handled = 0;
+            while (handled < BATCH && inbound_.try_pop(command)) {
+                dispatch(command);
+                ++handled;
+            }
+            if (handled == 0) {
+                if (stopping) return;
+                spin_wait(spins);
+            }
+        }
+    }
+
+    // Unknown symbols go to shard 0, which rejects them
+    void dispatch(const OrderCmd& command) noexcept {
+        uint32_t dense = manager_.dense_id(command.symbol);
+        size_t shard = dense != Manager::NO_BOOK ? shard_of_[dense] : 0;
+        size_t spins = 0;
+        while (!shards_[shard]->submit(command)) {
+            ++stalls_;
+            spin_wait(spins);
+        }
+        ++routed_[shard];
+    }
+
+    // Takes the pending moves under the lock and waits for the old shards without it, so a gateway calling
+    // move_symbol() meanwhile is never held up behind a shard that is waiting on its outbound ring
+    void apply_moves() {
+        std::vector<Move> moves;
+        {
+            std::lock_guard<std::mutex> lock(moves_mutex_);
+            moves.swap(moves_);
+            moves_pending_.store(false, std::memory_order_relaxed);
+        }
+        for (const Move& move : moves) {
+            uint32_t from = shard_of_[move.dense_id];
+            if (from == move.shard) continue;
+            // The old shard's release store of processed_ after its last batch makes its writes to the book visible
+            // here, and the new shard sees them through its inbound ring
+            size_t spins = 0;
+            while (shards_[from]->processed_.load(std::memory_order_acquire) != routed_[from]) spin_wait(spins);
+            shard_of_[move.dense_id] = move.shard;
+            ++moved_;
+        }
+    }
+};
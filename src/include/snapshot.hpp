@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "checksum.hpp"
+#include "mapped_file.hpp"
+#include "orderbook.hpp"
+
+// Binary image of a book: a header, then every non-empty level of the bid side and then of the ask side, each level
+// followed by its orders in queue order. Handles are not stored, restoring allocates the orders afresh from the pool
+// so the restored pool is compact and its free list is whatever the pool had left.
+// The window position of each side is kept, so every level goes back into the dense window or the overflow exactly
+// where it was and the best level comes out the same
+struct SnapshotHeader {
+    static constexpr char MAGIC[8] = {'L', 'O', 'B', 'S', 'N', 'A', 'P', '1'};
+    char magic[8];
+    uint32_t checksum; // CRC-32C of everything after the header
+    uint32_t reserved;
+    uint64_t body_size;
+    uint64_t sequence; // Journal sequence of the first command not reflected in the image
+    uint64_t price_min;
+    uint64_t price_max;
+    uint64_t tick_size;
+    uint64_t num_levels;
+    uint64_t num_orders;
+    uint64_t base_ticks[2]; // Bids, asks
+    uint64_t best_prices[2]; // 0 if the side is empty
+    uint64_t num_price_levels[2];
+};
+
+struct SnapshotLevel {
+    uint64_t tick;
+    uint64_t order_count;
+};
+
+struct SnapshotOrder {
+    uint64_t id;
+    uint64_t quantity;
+};
+
+// Calls fn(tick, first order, order count) for every non-empty level of a side, window first
+template <typename BookSide, typename Fn>
+void for_each_level(const BookSide& side, Fn&& fn) {
+    for (size_t pos = 0; ; ) {
+        size_t idx = side.first_occupied_from(pos);
+        if (idx == side.num_levels()) break;
+        pos = side.logical(idx);
+        fn(side.base_tick_ + pos, side.heads_[idx], side.counts_[idx]);
+        ++pos;
+    }
+    for (const auto& [tick, level] : side.overflow_) fn(tick, level.first_, level.order_count_);
+}
+
+template <typename Book>
+size_t snapshot_size(const Book& book) noexcept {
+    // Counted from the levels, which is what write_snapshot walks
+    size_t num_levels = 0, num_orders = 0;
+    auto count = [&](size_t, auto, size_t order_count) {
+        ++num_levels;
+        num_orders += order_count;
+    };
+    for_each_level(book.bids, count);
+    for_each_level(book.asks, count);
+    return sizeof(SnapshotHeader) + num_levels * sizeof(SnapshotLevel) + num_orders * sizeof(SnapshotOrder);
+}
+
+// out must have room for snapshot_size(book) bytes. Returns the bytes written
+template <typename Book>
+size_t write_snapshot(const Book& book, char* out, uint64_t sequence = 0) noexcept {
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic));
+    header.sequence = sequence;
+    header.price_min = book.bids.instrument_.price_min();
+    header.price_max = book.bids.instrument_.price_max();
+    header.tick_size = book.bids.instrument_.tick_size();
+    header.num_levels = book.bids.num_levels();
+    header.base_ticks[0] = book.bids.base_tick_;
+    header.base_ticks[1] = book.asks.base_tick_;
+    header.best_prices[0] = book.bids.best_price();
+    header.best_prices[1] = book.asks.best_price();
+
+    char* cursor = out + sizeof(SnapshotHeader);
+    auto write_side = [&](const auto& side, uint64_t& num_price_levels) {
+        for_each_level(side, [&](size_t tick, auto handle, size_t order_count) {
+            SnapshotLevel level{tick, order_count};
+            std::memcpy(cursor, &level, sizeof(level));
+            cursor += sizeof(level);
+            for (size_t i = 0; i < order_count; ++i, handle = book.pool_.at(handle).next_) {
+                SnapshotOrder order{book.pool_.id(handle), book.pool_.at(handle).quantity_};
+                std::memcpy(cursor, &order, sizeof(order));
+                cursor += sizeof(order);
+            }
+            header.num_orders += order_count;
+            ++num_price_levels;
+        });
+    };
+    write_side(book.bids, header.num_price_levels[0]);
+    write_side(book.asks, header.num_price_levels[1]);
+
+    header.body_size = static_cast<uint64_t>(cursor - out) - sizeof(SnapshotHeader);
+    header.checksum = crc32c(0, out + sizeof(SnapshotHeader), header.body_size);
+    std::memcpy(out, &header, sizeof(header));
+    return static_cast<size_t>(cursor - out);
+}
+
+// Links count orders into the level at tick, placing it in the window or the overflow. False if the pool runs out,
+// an order does not fit the layout or its ID is already resting
+template <typename BookSide>
+bool restore_level(BookSide& side, size_t tick, const char* orders, size_t count) noexcept {
+    using Handle = typename BookSide::Handle;
+    using Order = typename BookSide::Order;
+    size_t price = tick * side.instrument_.tick_size();
+    if (count == 0 || count > std::numeric_limits<uint32_t>::max() || price > BookSide::MAX_PRICE) return false;
+
+    Handle first = BookSide::NIL, last = BookSide::NIL;
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        SnapshotOrder snapshot;
+        std::memcpy(&snapshot, orders + i * sizeof(SnapshotOrder), sizeof(snapshot));
+        if (snapshot.quantity == 0 || snapshot.quantity > BookSide::MAX_QUANTITY) return false;
+        Handle handle = side.pool_.allocate();
+        if (handle == BookSide::NIL) return false;
+        Order& order = side.pool_.at(handle);
+        side.pool_.set_id(handle, snapshot.id);
+        order.price_ = static_cast<decltype(order.price_)>(price);
+        order.quantity_ = static_cast<decltype(order.quantity_)>(snapshot.quantity);
+        order.prev_ = last;
+        if (last != BookSide::NIL) {
+            side.pool_.at(last).next_ = handle;
+        } else {
+            first = handle;
+        }
+        last = handle;
+        total += snapshot.quantity;
+        if (!side.index_.insert(snapshot.id, handle, BookSide::IS_BID)) return false;
+    }
+
+    if (side.in_window(tick)) {
+        size_t idx = tick & side.mask();
+        if (side.heads_[idx] != BookSide::NIL) return false; // Listed twice
+        side.quantities_[idx] = total;
+        side.heads_[idx] = first;
+        side.tails_[idx] = last;
+        side.counts_[idx] = static_cast<uint32_t>(count);
+        side.mark_occupied(idx);
+    } else {
+        bool inserted = side.overflow_.try_emplace(
+            tick, typename BookSide::Level{price, total, first, last, static_cast<uint32_t>(count)}
+        ).second;
+        if (!inserted) return false;
+    }
+    return true;
+}
+
+// Rebuilds an empty book from an image, in time linear in the live orders. The book must have the same instrument
+// geometry as the one the image was taken from and room for all its orders. False if the image is damaged or does
+// not fit, the book is left partly filled then and should be thrown away
+template <typename Book>
+bool restore_snapshot(Book& book, const char* data, size_t size, uint64_t* sequence = nullptr) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) return false;
+    std::memcpy(&header, data, sizeof(header));
+    const auto& instrument = book.bids.instrument_;
+    if (std::memcmp(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic)) != 0
+        || header.body_size != size - sizeof(header)
+        || header.checksum != crc32c(0, data + sizeof(header), header.body_size)
+        || header.price_min != instrument.price_min() || header.price_max != instrument.price_max()
+        || header.tick_size != instrument.tick_size() || header.num_levels != book.bids.num_levels()
+        || header.num_orders > instrument.max_orders()
+        || book.index_.size_ != 0) {
+        return false;
+    }
+
+    if (2 * header.num_orders > book.index_.table_.size()) book.index_.rehash(ceil_pow2(2 * header.num_orders));
+    book.bids.base_tick_ = header.base_ticks[0];
+    book.asks.base_tick_ = header.base_ticks[1];
+
+    const char* cursor = data + sizeof(header);
+    const char* end = data + size;
+    auto read_side = [&](auto& side, uint64_t num_price_levels) {
+        for (uint64_t i = 0; i < num_price_levels; ++i) {
+            SnapshotLevel level;
+            if (static_cast<size_t>(end - cursor) < sizeof(level)) return false;
+            std::memcpy(&level, cursor, sizeof(level));
+            cursor += sizeof(level);
+            if (level.order_count > static_cast<size_t>(end - cursor) / sizeof(SnapshotOrder)) return false;
+            if (!restore_level(side, level.tick, cursor, level.order_count)) return false;
+            cursor += level.order_count * sizeof(SnapshotOrder);
+        }
+        // Same window as before, so the best level is the best occupied slot
+        if constexpr (std::decay_t<decltype(side)>::IS_BID) {
+            side.best_price_index_ = side.last_occupied_upto(side.mask());
+        } else {
+            side.best_price_index_ = side.first_occupied_from(0);
+        }
+        return true;
+    };
+    if (!read_side(book.bids, header.num_price_levels[0]) || !read_side(book.asks, header.num_price_levels[1])) {
+        return false;
+    }
+    if (cursor != end || book.index_.size_ != header.num_orders
+        || book.bids.best_price() != header.best_prices[0] || book.asks.best_price() != header.best_prices[1]) {
+        return false;
+    }
+
+    book.published_bbo_ = book.bbo();
+    book.top_of_book_.publish(book.published_bbo_);
+    if (sequence) *sequence = header.sequence;
+    return true;
+}
+
+// Writes the image through a shared mapping of a new file at path and syncs it
+template <typename Book>
+bool save_snapshot(const Book& book, const char* path, uint64_t sequence = 0) {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    size_t size = snapshot_size(book);
+    void* memory = ftruncate(fd, static_cast<off_t>(size)) == 0
+        ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+    if (memory == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    size_t written = write_snapshot(book, static_cast<char*>(memory), sequence);
+    bool ok = written == size && msync(memory, size, MS_SYNC) == 0;
+    munmap(memory, size);
+    ::close(fd);
+    return ok;
+}
+
+// Maps the file read-only and restores from the mapping, see restore_snapshot
+template <typename Book>
+bool load_snapshot(Book& book, const char* path, uint64_t* sequence = nullptr) {
+    MappedFile file;
+    if (!file.open(path, sizeof(SnapshotHeader))) return false;
+    return restore_snapshot(book, file.data(), file.size(), sequence);
+}
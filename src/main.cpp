@@ -1,8 +1,21 @@
 #include "orderbook.hpp"
+#include "engine.hpp"
+#include "book_manager.hpp"
+#include "sharded_runtime.hpp"
+#include "journal.hpp"
+#include "snapshot.hpp"
+#include "replay.hpp"
+#include "itch.hpp"
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <random>
 #include <chrono>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <cstdio>
 
 void print_trades(std::vector<Trade>& trades) {
     for (auto trade : trades) {
@@ -16,13 +29,41 @@ void print_trades(std::vector<Trade>& trades) {
     
 }
 
-void performance_test() {
-    OrderBook orderbook;
+void print_report(const ExecutionReport& report) {
+    static const char* const TYPES[] = {"ACK", "PARTIAL", "FILL", "REST", "CANCEL", "REJECT"};
+    static const char* const REASONS[] = {"", " zero quantity", " unknown order", " book full", " does not fit",
+                                         " unknown symbol", " duplicate id", " off tick"};
+    std::cout << TYPES[static_cast<size_t>(report.type)] << REASONS[static_cast<size_t>(report.reason)]
+              << " id=" << report.order_id << (report.is_bid ? " bid " : " ask ") << report.quantity << "@" << report.price
+              << " leaves=" << report.leaves_quantity;
+    if (report.contra_order_id != ExecutionReport::NO_ORDER) std::cout << " contra=" << report.contra_order_id;
+    std::cout << "\n";
+}
+
+void print_delta(const BookDelta& delta) {
+    std::cout << "DELTA";
+    for (size_t i = 0; i < delta.num_levels; ++i) {
+        const LevelUpdate& level = delta.levels[i];
+        std::cout << (level.is_bid ? " bid " : " ask ") << level.price << "=" << level.quantity;
+    }
+    if (delta.bbo_changed) {
+        std::cout << " | BBO " << delta.bbo.bid_quantity << "@" << delta.bbo.bid_price
+                  << " / " << delta.bbo.ask_quantity << "@" << delta.bbo.ask_price;
+    }
+    std::cout << "\n";
+}
+
+template <typename Instrument, typename Layout = PointerLayout>
+void performance_test(
+    const char* name, const Instrument& instrument, LevelSearch level_search = LevelSearch::Bitmap, L3Writer* l3 = nullptr
+) {
+    OrderBook<Instrument, Layout> orderbook(instrument, PoolOptions{}, level_search);
+    orderbook.attach_l3(l3);
 
     constexpr size_t NUM_ORDERS = 1'000'000;
     std::mt19937_64 rng(5);
 
-    std::uniform_int_distribution<size_t> price_dist(PRICE_MIN, PRICE_MAX);
+    std::uniform_int_distribution<size_t> price_dist(instrument.price_min(), instrument.price_max());
     std::uniform_int_distribution<size_t> qty_dist(1, 10);
     std::bernoulli_distribution side_dist(0.5);
 
@@ -39,29 +80,242 @@ void performance_test() {
         is_buys.push_back(side_dist(rng));
     }
 
-    std::vector<Trade> all_trades;
-    all_trades.reserve(NUM_ORDERS);
-
-    std::vector<Trade> trades;
-    trades.reserve(16);
+    std::vector<Trade> all_trades(NUM_ORDERS);
+    SpanTradeSink sink(all_trades.data(), all_trades.size()); // Fills land in all_trades directly
 
     auto start = std::chrono::high_resolution_clock::now();
 
     for (size_t i = 0; i < NUM_ORDERS; ++i) {
 
-        orderbook.submit_order(prices[i], quantities[i], i, is_buys[i], trades);
-        all_trades.insert(all_trades.end(), trades.begin(), trades.end());
+        orderbook.submit_order(prices[i], quantities[i], i, is_buys[i], sink);
     }
 
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed = end - start;
 
-    std::cout << "Processed " << NUM_ORDERS << " orders in " 
+    std::cout << "[" << name << "] Processed " << NUM_ORDERS << " orders in " 
               << elapsed.count() << " seconds.\n";
 }
 
+// Deep resting book with heavy cancel flow, where the order layout decides how many orders fit in cache
+template <typename Layout>
+void layout_test(const char* name) {
+    using Instrument = StaticInstrument<9'000, 11'000, 1, 4'000'000>;
+    OrderBook<Instrument, Layout> orderbook;
+
+    constexpr size_t NUM_RESTING = 2'000'000;
+    constexpr size_t NUM_ORDERS = 1'000'000;
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<size_t> qty_dist(1, 10);
+    std::uniform_int_distribution<size_t> offset_dist(1, 1'000);
+
+    std::vector<Trade> trades;
+    trades.reserve(1'024);
+    std::vector<size_t> live;
+    live.reserve(NUM_RESTING + NUM_ORDERS);
+
+    size_t id = 0;
+    for (; id < NUM_RESTING; ++id) {
+        bool is_bid = id & 1;
+        size_t price = is_bid ? 10'000 - offset_dist(rng) : 10'000 + offset_dist(rng);
+        orderbook.submit_order(price, qty_dist(rng), id, is_bid, trades);
+        live.push_back(id);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (size_t i = 0; i < NUM_ORDERS; ++i, ++id) {
+        size_t action = rng() % 100;
+        if (action < 45) {
+            size_t k = rng() % live.size();
+            orderbook.cancel_order(live[k]);
+            live[k] = live.back();
+            live.pop_back();
+        } else {
+            bool is_bid = rng() & 1;
+            size_t offset = action < 55 ? 0 : offset_dist(rng); // 10% cross the spread and sweep
+            size_t price = is_bid ? 10'000 - offset : 10'000 + offset;
+            orderbook.submit_order(price, action < 55 ? 50 : qty_dist(rng), id, is_bid, trades);
+            live.push_back(id);
+        }
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+
+    std::cout << "[" << name << "] " << sizeof(typename Layout::Order) << " byte orders, processed " << NUM_ORDERS
+              << " events on a " << NUM_RESTING << " order book in " << elapsed.count() << " seconds.\n";
+}
+
+// The same command stream on a deep book, one command at a time and as a prefetching batch
+void batch_test() {
+    using Instrument = StaticInstrument<9'000, 11'000, 1, 4'000'000>;
+    constexpr size_t NUM_RESTING = 2'000'000;
+    constexpr size_t NUM_COMMANDS = 1'000'000;
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<size_t> qty_dist(1, 10);
+    std::uniform_int_distribution<size_t> offset_dist(1, 1'000);
+
+    std::vector<OrderCmd> resting, commands;
+    resting.reserve(NUM_RESTING);
+    commands.reserve(NUM_COMMANDS);
+    size_t id = 0;
+    for (; id < NUM_RESTING; ++id) {
+        bool is_bid = id & 1;
+        size_t price = is_bid ? 10'000 - offset_dist(rng) : 10'000 + offset_dist(rng);
+        resting.push_back(OrderCmd{CommandType::New, is_bid, 0, id, price, qty_dist(rng)});
+    }
+    for (size_t i = 0; i < NUM_COMMANDS; ++i, ++id) {
+        size_t action = rng() % 100;
+        if (action < 45) {
+            commands.push_back(OrderCmd{CommandType::Cancel, false, 0, rng() % id, 0, 0});
+        } else {
+            bool is_bid = rng() & 1;
+            size_t offset = action < 55 ? 0 : offset_dist(rng);
+            size_t price = is_bid ? 10'000 - offset : 10'000 + offset;
+            commands.push_back(OrderCmd{CommandType::New, is_bid, 0, id, price, action < 55 ? 50 : qty_dist(rng)});
+        }
+    }
+
+    for (bool batched : {false, true}) {
+        OrderBook<Instrument> orderbook;
+        SpanTradeSink sink(nullptr, 0);
+        orderbook.submit_orders(resting.data(), resting.size(), sink);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (batched) {
+            orderbook.submit_orders(commands.data(), commands.size(), sink);
+        } else {
+            for (const OrderCmd& command : commands) orderbook.execute(command, sink);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+
+        std::cout << "[" << (batched ? "batch" : "one by one") << "] processed " << NUM_COMMANDS << " commands on a "
+                  << NUM_RESTING << " order book in " << elapsed.count() << " seconds.\n";
+    }
+}
+
+// 20k symbols in one manager, 80% of the flow goes to 1% of them. Run once with the busy symbols spread across the
+// arena and once with them flagged hot
+void manager_test() {
+    constexpr size_t NUM_SYMBOLS = 20'000;
+    constexpr size_t NUM_HOT = 200;
+    constexpr size_t NUM_ORDERS = 1'000'000;
+    std::mt19937_64 rng(17);
+    std::uniform_int_distribution<size_t> offset_dist(0, 100);
+    std::uniform_int_distribution<size_t> qty_dist(1, 10);
+
+    std::vector<uint32_t> hot_symbols(NUM_HOT);
+    for (uint32_t& symbol : hot_symbols) symbol = static_cast<uint32_t>(rng() % NUM_SYMBOLS) * 3 + 1;
+    std::vector<OrderCmd> commands(NUM_ORDERS);
+    for (size_t i = 0; i < NUM_ORDERS; ++i) {
+        uint32_t symbol = rng() % 10 < 8
+            ? hot_symbols[rng() % NUM_HOT]
+            : static_cast<uint32_t>(rng() % NUM_SYMBOLS) * 3 + 1;
+        bool is_bid = rng() & 1;
+        size_t price = is_bid ? 1'000 - offset_dist(rng) : 998 + offset_dist(rng); // Overlaps a little, so some cross
+        commands[i] = OrderCmd{CommandType::New, is_bid, symbol, i, price, qty_dist(rng)};
+    }
+
+    for (bool flag_hot : {false, true}) {
+        std::vector<SymbolConfig> configs;
+        configs.reserve(NUM_SYMBOLS);
+        for (size_t i = 0; i < NUM_SYMBOLS; ++i) {
+            configs.push_back(SymbolConfig{static_cast<uint32_t>(i * 3 + 1), 800, 1'200, 1, 256, 256});
+        }
+        if (flag_hot) {
+            for (uint32_t symbol : hot_symbols) configs[(symbol - 1) / 3].hot = true;
+        }
+        auto build_start = std::chrono::high_resolution_clock::now();
+        BookManager<CompactLayout<>> manager(configs);
+        auto build_end = std::chrono::high_resolution_clock::now();
+
+        SpanTradeSink sink(nullptr, 0);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const OrderCmd& command : commands) manager.execute(command, sink);
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> build = build_end - build_start, elapsed = end - start;
+
+        std::cout << "[manager" << (flag_hot ? " hot" : "") << "] " << manager.size() << " books built in "
+                  << build.count() << " seconds, " << NUM_ORDERS << " orders in " << elapsed.count() << " seconds.\n";
+    }
+}
+
+// 10-level snapshots of both sides, on books where the resting orders leave more or fewer empty levels in between
+void depth_test() {
+    using Instrument = StaticInstrument<9'000, 11'000, 1, 200'000>;
+    constexpr size_t DEPTH = 10;
+    constexpr size_t NUM_SNAPSHOTS = 1'000'000;
+
+    for (size_t num_resting : {100'000, 1'000, 50}) {
+        OrderBook<Instrument> orderbook;
+        std::mt19937_64 rng(13);
+        std::uniform_int_distribution<size_t> offset_dist(1, 1'000);
+        std::vector<Trade> trades;
+        for (size_t id = 0; id < num_resting; ++id) {
+            bool is_bid = id & 1;
+            size_t price = is_bid ? 10'000 - offset_dist(rng) : 10'000 + offset_dist(rng);
+            orderbook.submit_order(price, 1, id, is_bid, trades);
+        }
+
+        size_t prices[DEPTH], quantities[DEPTH];
+        size_t checksum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < NUM_SNAPSHOTS; ++i) {
+            size_t n = orderbook.bids.depth(DEPTH, prices, quantities);
+            n += orderbook.asks.depth(DEPTH, prices, quantities);
+            checksum += n + prices[0] + quantities[0];
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::nano> elapsed = end - start;
+
+        std::cout << "[depth] " << num_resting << " resting orders: " << elapsed.count() / NUM_SNAPSHOTS
+                  << " ns per " << DEPTH << "-level snapshot of both sides (checksum " << checksum << ")\n";
+    }
+}
+
+// Next non-empty level lookups on a single ladder, comparing the scan kernels with the occupancy bitmap
+void level_search_test() {
+    constexpr size_t NUM_LEVELS = 1 << 16;
+    constexpr size_t NUM_LOOKUPS = 1'000'000;
+    const LevelScanKernels& kernels = level_scan_kernels();
+
+    for (double density : {0.5, 0.05, 0.005, 0.0005}) {
+        std::mt19937_64 rng(11);
+        std::bernoulli_distribution filled(density);
+        std::vector<size_t> quantities(NUM_LEVELS, 0);
+        LevelBitmap occupied(NUM_LEVELS);
+        for (size_t i = 0; i < NUM_LEVELS; ++i) {
+            if (filled(rng)) {
+                quantities[i] = 1;
+                occupied.set(i);
+            }
+        }
+        std::vector<size_t> starts(NUM_LOOKUPS);
+        for (size_t& start : starts) start = rng() % NUM_LEVELS;
+
+        auto time = [&](auto&& lookup) {
+            size_t checksum = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t from : starts) checksum += lookup(from);
+            auto end = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::nano> elapsed = end - start;
+            return std::make_pair(elapsed.count() / NUM_LOOKUPS, checksum);
+        };
+
+        auto scalar = time([&](size_t from) { return scan_forward_scalar(quantities.data(), from, NUM_LEVELS); });
+        auto simd = time([&](size_t from) { return kernels.forward_(quantities.data(), from, NUM_LEVELS); });
+        auto bitmap = time([&](size_t from) { return occupied.next(from); });
+        assert(scalar.second == simd.second && scalar.second == bitmap.second);
+
+        std::cout << "[level search] density " << density << ": scalar " << scalar.first << " ns, "
+                  << kernels.name_ << " " << simd.first << " ns, bitmap " << bitmap.first << " ns per lookup\n";
+    }
+}
+
 void order_test() {
-    OrderBook orderbook;
+    OrderBook<> orderbook;
 
     std::vector<Trade> all_trades;
 
@@ -83,12 +337,578 @@ void order_test() {
     orderbook.submit_order(902, 5, 4, false, trades);
     all_trades.insert(all_trades.end(), trades.begin(), trades.end());
 
+    orderbook.submit_order(899, 10, 5, true, trades);
+    all_trades.insert(all_trades.end(), trades.begin(), trades.end());
+    orderbook.cancel_order(5);
+
+    orderbook.modify_order(0, 900, 12, trades); // Keeps priority
+    orderbook.submit_order(903, 4, 6, false, trades);
+    all_trades.insert(all_trades.end(), trades.begin(), trades.end());
+    orderbook.modify_order(6, 902, 4, trades); // Crosses the resting bid at 902
+    all_trades.insert(all_trades.end(), trades.begin(), trades.end());
+
     orderbook.print_book();
     print_trades(all_trades);
 }
 
-int main() {
-    performance_test();
+// Execution reports on a book that only has room for two resting orders
+void report_test() {
+    OrderBook<StaticInstrument<800, 1200, 1, 2>> orderbook;
+    auto listener = [](const ExecutionReport& report) { print_report(report); };
+
+    orderbook.submit_order(900, 10, 0, true, listener);
+    orderbook.submit_order(901, 5, 1, true, listener);
+    orderbook.submit_order(902, 5, 2, true, listener); // No room left to rest
+    orderbook.submit_order(900, 12, 3, false, listener);
+    orderbook.submit_order(950, 0, 4, false, listener);
+    orderbook.modify_order(0, 900, 1, listener);
+    orderbook.cancel_order(0, listener);
+    orderbook.cancel_order(0, listener);
+}
+
+// One conflated L2 delta per message, a sweep through three levels reports each level once
+void delta_test() {
+    OrderBook<> orderbook;
+    auto publisher = [](const BookDelta& delta) { print_delta(delta); };
+
+    orderbook.submit_order(901, 5, 0, false, publisher);
+    orderbook.submit_order(901, 5, 1, false, publisher);
+    orderbook.submit_order(902, 5, 2, false, publisher);
+    orderbook.submit_order(903, 5, 3, false, publisher);
+    orderbook.submit_order(899, 5, 4, true, publisher);
+    orderbook.submit_order(902, 18, 5, true, publisher); // Sweeps 901 and 902, rests 3 at 902
+    orderbook.modify_order(4, 900, 5, publisher);
+    orderbook.cancel_order(3, publisher);
+}
+
+void print_l3(const char* data, size_t size) {
+    for (size_t offset = 0; offset < size; offset += l3_message_size(data[offset])) {
+        switch (data[offset]) {
+            case L3Add::TYPE: {
+                L3Add m;
+                std::memcpy(&m, data + offset, sizeof(m));
+                std::cout << m.sequence << " A id=" << m.order_id << (m.is_bid ? " bid " : " ask ") << m.quantity << "@"
+                          << m.price << "\n";
+                break;
+            }
+            case L3Execute::TYPE: {
+                L3Execute m;
+                std::memcpy(&m, data + offset, sizeof(m));
+                std::cout << m.sequence << " E id=" << m.order_id << " qty=" << m.quantity << " match=" << m.match_id << "\n";
+                break;
+            }
+            case L3Cancel::TYPE: {
+                L3Cancel m;
+                std::memcpy(&m, data + offset, sizeof(m));
+                std::cout << m.sequence << " X id=" << m.order_id << " qty=" << m.quantity << "\n";
+                break;
+            }
+            case L3Delete::TYPE: {
+                L3Delete m;
+                std::memcpy(&m, data + offset, sizeof(m));
+                std::cout << m.sequence << " D id=" << m.order_id << "\n";
+                break;
+            }
+            case L3Replace::TYPE: {
+                L3Replace m;
+                std::memcpy(&m, data + offset, sizeof(m));
+                std::cout << m.sequence << " U id=" << m.order_id << " " << m.quantity << "@" << m.price << "\n";
+                break;
+            }
+        }
+    }
+}
+
+// Matching thread throughput while reader threads poll the seqlocked BBO as fast as they can
+void bbo_reader_test() {
+    constexpr size_t NUM_ORDERS = 1'000'000;
+    DefaultInstrument instrument;
+    std::mt19937_64 rng(5);
+    std::uniform_int_distribution<size_t> price_dist(instrument.price_min(), instrument.price_max());
+    std::uniform_int_distribution<size_t> qty_dist(1, 10);
+    std::vector<size_t> prices(NUM_ORDERS), quantities(NUM_ORDERS);
+    for (size_t i = 0; i < NUM_ORDERS; ++i) {
+        prices[i] = price_dist(rng);
+        quantities[i] = qty_dist(rng);
+    }
+
+    for (size_t num_readers : {0, 1, 2, 4}) {
+        auto orderbook = std::make_unique<OrderBook<>>();
+        std::atomic<bool> done{false};
+        std::atomic<size_t> reads{0}, crossed{0};
+        std::vector<std::thread> readers;
+        for (size_t r = 0; r < num_readers; ++r) {
+            readers.emplace_back([&] {
+                size_t count = 0, bad = 0;
+                while (!done.load(std::memory_order_relaxed)) {
+                    Bbo bbo = orderbook->top_of_book_.load();
+                    bad += bbo.bid_price && bbo.ask_price && bbo.bid_price >= bbo.ask_price; // Torn reads would show up here
+                    ++count;
+                }
+                reads += count;
+                crossed += bad;
+            });
+        }
+
+        SpanTradeSink sink(nullptr, 0);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < NUM_ORDERS; ++i) {
+            orderbook->submit_order(prices[i], quantities[i], i, i & 1, sink);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        done = true;
+        for (std::thread& reader : readers) reader.join();
+        std::chrono::duration<double> elapsed = end - start;
+
+        std::cout << "[bbo] " << num_readers << " readers: " << NUM_ORDERS << " orders in " << elapsed.count()
+                  << " seconds, " << reads << " reads, " << crossed << " crossed\n";
+    }
+}
+
+// Gateway threads feed the engine thread through the inbound ring while this thread drains the reports. Latency is
+// measured from the push of a command to the pop of its ack, every order gets exactly one
+template <typename InboundRing>
+void engine_test(const char* name, size_t num_producers) {
+    using Book = OrderBook<>;
+    using Engine = MatchingEngine<Book, InboundRing>;
+    constexpr size_t NUM_ORDERS = 1'000'000;
+    using Clock = std::chrono::steady_clock;
+
+    auto orderbook = std::make_unique<Book>();
+    auto engine = std::make_unique<Engine>(*orderbook);
+    unsigned num_cpus = std::thread::hardware_concurrency();
+    engine->start(num_cpus > 1 ? static_cast<int>(num_cpus - 1) : -1);
+
+    DefaultInstrument instrument;
+    std::vector<OrderCmd> commands(NUM_ORDERS);
+    std::mt19937_64 rng(5);
+    std::uniform_int_distribution<size_t> price_dist(instrument.price_min(), instrument.price_max());
+    std::uniform_int_distribution<size_t> qty_dist(1, 10);
+    for (size_t i = 0; i < NUM_ORDERS; ++i) {
+        commands[i] = OrderCmd{CommandType::New, static_cast<bool>(rng() & 1), 0, i, price_dist(rng), qty_dist(rng)};
+    }
+    std::vector<Clock::time_point> sent(NUM_ORDERS);
+    std::vector<uint32_t> latencies;
+    latencies.reserve(NUM_ORDERS);
+
+    auto start = Clock::now();
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < num_producers; ++p) {
+        producers.emplace_back([&, p] {
+            size_t spins = 0;
+            for (size_t i = p; i < NUM_ORDERS; i += num_producers) {
+                sent[i] = Clock::now();
+                while (!engine->submit(commands[i])) spin_wait(spins);
+            }
+        });
+    }
+
+    size_t acks = 0, reports = 0, spins = 0;
+    ExecutionReport report;
+    while (acks < NUM_ORDERS) {
+        if (!engine->poll(report)) {
+            spin_wait(spins);
+            continue;
+        }
+        ++reports;
+        if (report.type == ExecType::Ack) {
+            ++acks;
+            latencies.push_back(static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent[report.order_id]).count()
+            ));
+        }
+    }
+    auto end = Clock::now();
+    for (std::thread& producer : producers) producer.join();
+    engine->stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "[engine " << name << "] " << num_producers << " producers: " << NUM_ORDERS / elapsed.count() / 1e6
+              << " M orders/s, " << reports << " reports, latency p50 " << latencies[latencies.size() / 2]
+              << " ns, p99 " << latencies[latencies.size() * 99 / 100] << " ns, " << engine->stalls_
+              << " outbound stalls\n";
+}
+
+// Multi-symbol flow through the sharded runtime with 1 to N engine threads. This thread is the gateway and drains
+// every shard's reports, halfway through a few symbols are moved to another shard
+void runtime_test() {
+    using Runtime = ShardedRuntime<CompactLayout<>>;
+    constexpr size_t NUM_SYMBOLS = 1'000;
+    constexpr size_t NUM_ORDERS = 2'000'000;
+    constexpr size_t NUM_MOVED = 10;
+    std::mt19937_64 rng(23);
+    std::uniform_int_distribution<size_t> offset_dist(0, 100);
+    std::uniform_int_distribution<size_t> qty_dist(1, 10);
+
+    std::vector<SymbolConfig> configs;
+    configs.reserve(NUM_SYMBOLS);
+    for (size_t i = 0; i < NUM_SYMBOLS; ++i) {
+        configs.push_back(SymbolConfig{static_cast<uint32_t>(i), 800, 1'200, 1, 8'192});
+    }
+    std::vector<OrderCmd> commands(NUM_ORDERS);
+    for (size_t i = 0; i < NUM_ORDERS; ++i) {
+        bool is_bid = rng() & 1;
+        size_t price = is_bid ? 1'000 - offset_dist(rng) : 998 + offset_dist(rng);
+        commands[i] = OrderCmd{CommandType::New, is_bid, static_cast<uint32_t>(rng() % NUM_SYMBOLS), i, price,
+                               qty_dist(rng)};
+    }
+
+    unsigned num_cpus = std::thread::hardware_concurrency();
+    size_t max_shards = std::max<size_t>(4, num_cpus > 1 ? num_cpus - 1 : 1);
+    double base_rate = 0;
+    for (size_t num_shards = 1; num_shards <= max_shards; num_shards *= 2) {
+        BookManager<CompactLayout<>> manager(configs);
+        auto runtime = std::make_unique<Runtime>(manager, num_shards);
+        runtime->start(num_cpus > num_shards + 1 ? 0 : -1);
+
+        size_t acks = 0, next = 0;
+        ExecutionReport report;
+        auto start = std::chrono::steady_clock::now();
+        while (acks < NUM_ORDERS) {
+            while (next < NUM_ORDERS && runtime->submit(commands[next])) {
+                if (++next == NUM_ORDERS / 2) {
+                    for (uint32_t symbol = 0; symbol < NUM_MOVED; ++symbol) {
+                        runtime->move_symbol(symbol, (Runtime::hash(symbol) + 1) % num_shards);
+                    }
+                }
+            }
+            for (size_t shard = 0; shard < num_shards; ++shard) {
+                while (runtime->poll(shard, report)) acks += report.type == ExecType::Ack;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        runtime->stop();
+
+        std::chrono::duration<double> elapsed = end - start;
+        double rate = NUM_ORDERS / elapsed.count();
+        if (num_shards == 1) base_rate = rate;
+        std::cout << "[sharded] " << num_shards << " shards: " << rate / 1e6 << " M orders/s, "
+                  << rate / base_rate << "x, " << runtime->moved_ << " symbols moved, " << runtime->stalls_
+                  << " router stalls\n";
+    }
+}
+
+// Journal every command before the book sees it, one msync per group. Group size 0 never syncs, the kernel writes
+// the pages back whenever it likes
+void journal_test() {
+    constexpr size_t NUM_ORDERS = 200'000;
+    const char* path = "lob_journal.bin";
+    DefaultInstrument instrument;
+    std::mt19937_64 rng(29);
+    std::uniform_int_distribution<size_t> price_dist(instrument.price_min(), instrument.price_max());
+    std::uniform_int_distribution<size_t> qty_dist(1, 10);
+    std::vector<OrderCmd> commands(NUM_ORDERS);
+    for (size_t i = 0; i < NUM_ORDERS; ++i) {
+        commands[i] = OrderCmd{CommandType::New, static_cast<bool>(rng() & 1), 0, i, price_dist(rng), qty_dist(rng)};
+    }
+
+    for (size_t group : {0, 1, 16, 256, 4'096}) {
+        size_t num_orders = group == 1 ? NUM_ORDERS / 20 : NUM_ORDERS; // A sync per order is slow
+        size_t batch = group == 0 ? 256 : group;
+        auto orderbook = std::make_unique<OrderBook<>>();
+        Journal journal;
+        if (!journal.open(path, JournalOptions{group, size_t{16} << 20})) {
+            std::cout << "[journal] cannot open " << path << "\n";
+            return;
+        }
+        SpanTradeSink sink(nullptr, 0);
+        size_t header_syncs = journal.syncs_;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < num_orders; i += batch) {
+            size_t count = std::min(batch, num_orders - i);
+            journal.append(commands.data() + i, count);
+            if (group > 0) journal.commit(); // Group 0 is the baseline that leaves writeback to the kernel
+            orderbook->submit_orders(commands.data() + i, count, sink);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        size_t syncs = journal.syncs_ - header_syncs;
+        journal.close();
+
+        std::chrono::duration<double> elapsed = end - start;
+        std::cout << "[journal] group " << group << ": " << num_orders / elapsed.count() / 1e6 << " M orders/s, "
+                  << syncs << " syncs";
+        if (syncs > 0) std::cout << ", " << elapsed.count() / syncs * 1e6 << " us per group";
+        std::cout << "\n";
+    }
+    std::remove(path);
+}
+
+// Rebuilding a deep book from a snapshot file against re-running the orders that built it
+void snapshot_test() {
+    using Book = OrderBook<RuntimeInstrument, CompactLayout<>>;
+    constexpr size_t NUM_RESTING = 1'000'000;
+    const char* path = "lob_snapshot.bin";
+    RuntimeInstrument instrument(9'000, 11'000, 1, NUM_RESTING);
+    std::mt19937_64 rng(31);
+    std::uniform_int_distribution<size_t> offset_dist(1, 1'500); // Some levels end up in the overflow
+    std::vector<OrderCmd> commands(NUM_RESTING);
+    for (size_t i = 0; i < NUM_RESTING; ++i) {
+        bool is_bid = i & 1;
+        size_t price = is_bid ? 10'000 - offset_dist(rng) : 10'000 + offset_dist(rng);
+        commands[i] = OrderCmd{CommandType::New, is_bid, 0, i, price, 1 + rng() % 100};
+    }
+
+    SpanTradeSink sink(nullptr, 0);
+    auto replayed = std::make_unique<Book>(instrument);
+    auto replay_start = std::chrono::high_resolution_clock::now();
+    replayed->submit_orders(commands.data(), commands.size(), sink);
+    auto replay_end = std::chrono::high_resolution_clock::now();
+
+    auto save_start = std::chrono::high_resolution_clock::now();
+    bool saved = save_snapshot(*replayed, path, NUM_RESTING);
+    auto save_end = std::chrono::high_resolution_clock::now();
+
+    auto restored = std::make_unique<Book>(instrument);
+    uint64_t sequence = 0;
+    auto load_start = std::chrono::high_resolution_clock::now();
+    bool loaded = saved && load_snapshot(*restored, path, &sequence);
+    auto load_end = std::chrono::high_resolution_clock::now();
+    std::remove(path);
+
+    std::chrono::duration<double> replay = replay_end - replay_start, save = save_end - save_start,
+        load = load_end - load_start;
+    std::cout << "[snapshot] " << NUM_RESTING << " orders, " << snapshot_size(*replayed) / (1 << 20) << " MB: replay "
+              << replay.count() << " s, save " << save.count() << " s, restore " << load.count() << " s, "
+              << (loaded && sequence == NUM_RESTING && restored->bbo() == replayed->bbo() ? "same book" : "MISMATCH")
+              << "\n";
+}
+
+// Live run that journals every batch and snapshots halfway, then a full replay of the journal and a failover replay
+// from the snapshot. Both must end with the live book, the full replay also with the live trades
+void replay_test() {
+    using Book = OrderBook<RuntimeInstrument, CompactLayout<>>;
+    constexpr size_t NUM_COMMANDS = 2'000'000;
+    constexpr size_t BATCH = 256;
+    const char* journal_path = "lob_replay.jrn";
+    const char* snapshot_path = "lob_replay.snap";
+    RuntimeInstrument instrument(800, 1'200, 1, 1'000'000);
+    std::mt19937_64 rng(37);
+    std::uniform_int_distribution<size_t> price_dist(900, 1'100);
+    std::vector<OrderCmd> commands(NUM_COMMANDS);
+    for (size_t i = 0; i < NUM_COMMANDS; ++i) {
+        size_t kind = rng() % 10;
+        bool is_bid = rng() & 1;
+        if (kind < 6 || i == 0) {
+            commands[i] = OrderCmd{CommandType::New, is_bid, 0, i, price_dist(rng), 1 + rng() % 10};
+        } else {
+            CommandType type = kind < 8 ? CommandType::Cancel : CommandType::Modify;
+            commands[i] = OrderCmd{type, is_bid, 0, rng() % i, price_dist(rng), 1 + rng() % 10};
+        }
+    }
+
+    auto live = std::make_unique<Book>(instrument);
+    ChecksumTradeSink live_trades;
+    Journal journal;
+    if (!journal.open(journal_path, JournalOptions{BATCH})) {
+        std::cout << "[replay] cannot open " << journal_path << "\n";
+        return;
+    }
+    bool saved = false;
+    for (size_t i = 0; i < NUM_COMMANDS; i += BATCH) {
+        size_t count = std::min(BATCH, NUM_COMMANDS - i);
+        journal.append(commands.data() + i, count);
+        journal.commit();
+        live->submit_orders(commands.data() + i, count, live_trades);
+        if (!saved && i + count >= NUM_COMMANDS / 2) saved = save_snapshot(*live, snapshot_path, journal.sequence());
+    }
+    journal.close();
+    uint32_t live_book = book_checksum(*live);
+
+    JournalReader reader;
+    auto full = std::make_unique<Book>(instrument);
+    ReplayResult replayed = reader.open(journal_path) ? replay_journal(*full, reader) : ReplayResult{};
+    auto failover = std::make_unique<Book>(instrument);
+    uint64_t sequence = 0;
+    auto restore_start = std::chrono::steady_clock::now();
+    bool restored = saved && load_snapshot(*failover, snapshot_path, &sequence);
+    auto restore_end = std::chrono::steady_clock::now();
+    ReplayResult tail = restored ? replay_journal(*failover, reader, sequence) : ReplayResult{};
+    std::remove(journal_path);
+    std::remove(snapshot_path);
+
+    bool same = replayed.commands == NUM_COMMANDS && replayed.trade_checksum == live_trades.crc_
+        && replayed.book_checksum == live_book;
+    std::cout << "[replay] " << replayed.commands << " commands, " << replayed.trades << " trades: "
+              << replayed.orders_per_second() / 1e6 << " M orders/s, trades " << std::hex << replayed.trade_checksum
+              << " book " << replayed.book_checksum << std::dec << (same ? ", matches live" : ", MISMATCH") << "\n";
+    std::chrono::duration<double> restore = restore_end - restore_start;
+    std::cout << "[replay] failover: snapshot at " << sequence << " restored in " << restore.count() << " s, "
+              << tail.commands << " commands replayed in " << tail.seconds << " s"
+              << (restored && tail.book_checksum == live_book ? ", matches live" : ", MISMATCH") << "\n";
+}
+
+// Synthetic ITCH 5.0 capture with a few of the shapes of real flow: activity is skewed towards a handful of symbols,
+// orders cluster at and just behind the touch, most of them are cancelled rather than executed and some are replaced
+bool generate_itch_sample(const char* path, size_t num_messages, size_t num_symbols) {
+    struct Live {
+        uint16_t locate;
+        uint64_t ref;
+        bool is_bid;
+        uint32_t shares;
+        uint32_t price;
+    };
+    std::mt19937_64 rng(41);
+    std::geometric_distribution<uint32_t> distance_dist(0.3); // Ticks behind the touch
+    std::vector<uint32_t> mids(num_symbols);
+    for (uint32_t& mid : mids) mid = static_cast<uint32_t>(20 + rng() % 300) * 10'000; // $20 to $320
+    std::vector<double> weights(num_symbols);
+    for (size_t i = 0; i < num_symbols; ++i) weights[i] = 1.0 / static_cast<double>(i + 1);
+    std::discrete_distribution<size_t> symbol_dist(weights.begin(), weights.end());
+
+    ItchWriter writer;
+    writer.buffer_.reserve(num_messages * 40);
+    writer.system_event(0, 'O');
+    std::vector<std::vector<Live>> live(num_symbols);
+    uint64_t next_ref = 1, next_match = 1, timestamp = 34'200'000'000'000; // 9:30
+    const char stock[8] = {'S', 'Y', 'N', 'T', ' ', ' ', ' ', ' '};
+    for (size_t i = 0; i < num_messages; ++i) {
+        timestamp += 1 + rng() % 2'000;
+        size_t symbol = symbol_dist(rng);
+        uint16_t locate = static_cast<uint16_t>(symbol + 1);
+        std::vector<Live>& orders = live[symbol];
+        size_t kind = orders.size() < 20 ? 0 : rng() % 100;
+        if (kind < 45) {
+            bool is_bid = rng() & 1;
+            uint32_t distance = (1 + distance_dist(rng)) * 100;
+            uint32_t price = is_bid ? mids[symbol] - distance : mids[symbol] + distance;
+            uint32_t shares = 100 * static_cast<uint32_t>(1 + rng() % 5);
+            writer.add(locate, timestamp, next_ref, is_bid, shares, stock, price);
+            orders.push_back(Live{locate, next_ref++, is_bid, shares, price});
+            continue;
+        }
+        size_t pick = rng() % orders.size();
+        Live& order = orders[pick];
+        if (kind < 85) {
+            writer.remove(locate, timestamp, order.ref);
+        } else if (kind < 90) {
+            uint32_t shares = std::min<uint32_t>(order.shares - 1, 100);
+            if (shares == 0) {
+                writer.remove(locate, timestamp, order.ref);
+            } else {
+                writer.cancel(locate, timestamp, order.ref, shares);
+                order.shares -= shares;
+                continue;
+            }
+        } else if (kind < 95) {
+            uint32_t price = order.is_bid ? order.price + 100 : order.price - 100; // Step towards the touch
+            if (order.is_bid ? price >= mids[symbol] : price <= mids[symbol]) price = order.price;
+            writer.replace(locate, timestamp, order.ref, next_ref, order.shares, price);
+            order.ref = next_ref++;
+            order.price = price;
+            continue;
+        } else {
+            uint32_t shares = rng() & 1 ? order.shares : std::min<uint32_t>(order.shares, 100);
+            writer.execute(locate, timestamp, order.ref, shares, next_match++);
+            if (shares < order.shares) {
+                order.shares -= shares;
+                continue;
+            }
+        }
+        order = orders.back();
+        orders.pop_back();
+    }
+    writer.system_event(timestamp, 'C');
+    return writer.save(path);
+}
+
+// Drives the books from an ITCH 5.0 capture, timing every order message. Without a path a synthetic sample is
+// generated first
+void itch_test(const char* path) {
+    using Layout = CompactLayout<>;
+    using Clock = std::chrono::steady_clock;
+    const char* sample_path = "lob_sample.itch";
+    if (!path) {
+        if (!generate_itch_sample(sample_path, 2'000'000, 50)) {
+            std::cout << "[itch] cannot write " << sample_path << "\n";
+            return;
+        }
+    }
+    ItchFile file;
+    bool opened = file.open(path ? path : sample_path);
+    if (!path) std::remove(sample_path);
+    if (!opened) {
+        std::cout << "[itch] cannot open " << (path ? path : sample_path) << "\n";
+        return;
+    }
+
+    ItchSymbolScan scan;
+    size_t num_messages = file.parse(scan);
+    BookManager<Layout> manager(scan.configs());
+    SpanTradeSink sink(nullptr, 0);
+    ItchBookDriver<Layout, SpanTradeSink> driver(manager, sink);
+
+    std::vector<uint32_t> latencies;
+    latencies.reserve(num_messages);
+    auto timed = [&](const auto& message) {
+        auto start = Clock::now();
+        driver(message);
+        latencies.push_back(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()
+        ));
+    };
+    auto start = Clock::now();
+    file.parse(timed);
+    auto end = Clock::now();
+
+    if (latencies.empty()) {
+        std::cout << "[itch] no order messages\n";
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "[itch] " << (path ? path : "synthetic") << ": " << num_messages << " messages, " << latencies.size()
+              << " order messages on " << manager.size() << " books, " << latencies.size() / elapsed.count() / 1e6
+              << " M/s, latency p50 " << latencies[latencies.size() / 2] << " ns, p99 "
+              << latencies[latencies.size() * 99 / 100] << " ns, p99.9 " << latencies[latencies.size() * 999 / 1'000]
+              << " ns, " << driver.skipped_ << " skipped\n";
+}
+
+// Order-by-order feed of a short sequence, decoded back from the binary buffer
+void l3_test() {
+    OrderBook<> orderbook;
+    L3Writer l3(4'096);
+    orderbook.attach_l3(&l3);
+    std::vector<Trade> trades;
+
+    orderbook.submit_order(901, 5, 0, false, trades);
+    orderbook.submit_order(902, 5, 1, false, trades);
+    orderbook.submit_order(899, 5, 2, true, trades);
+    orderbook.submit_order(901, 8, 3, true, trades); // Executes 0 and rests 3 at 901
+    orderbook.modify_order(2, 899, 2, trades); // Partial cancel
+    orderbook.modify_order(2, 900, 2, trades); // Replace
+    orderbook.modify_order(3, 902, 3, trades); // Re-entry trades away, so a delete
+    orderbook.cancel_order(2);
+
+    print_l3(l3.data(), l3.size());
+}
+
+int main(int argc, char** argv) {
+    performance_test("static", DefaultInstrument{});
+    performance_test("runtime", RuntimeInstrument(800, 1200, 1, 1'000));
+    performance_test<DefaultInstrument, CompactLayout<>>("static/compact", DefaultInstrument{});
+    performance_test("static/scan", DefaultInstrument{}, LevelSearch::Scan);
+    L3Writer l3(1 << 20, [](void*, const char*, size_t) {}); // Flushed 1MB at a time, into nothing
+    performance_test("static/l3", DefaultInstrument{}, LevelSearch::Bitmap, &l3);
+    layout_test<PointerLayout>("pointer layout");
+    layout_test<CompactLayout<>>("compact layout");
+    batch_test();
+    manager_test();
+    level_search_test();
+    depth_test();
     order_test();
+    report_test();
+    delta_test();
+    l3_test();
+    bbo_reader_test();
+    engine_test<SpscRing<OrderCmd, 1 << 16>>("spsc", 1);
+    for (size_t num_producers : {1, 2, 4}) {
+        engine_test<MpscRing<OrderCmd, 1 << 16>>("mpsc", num_producers);
+    }
+    runtime_test();
+    journal_test();
+    snapshot_test();
+    replay_test();
+    itch_test(argc > 1 ? argv[1] : nullptr);
     return 0;
 }